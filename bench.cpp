@@ -0,0 +1,395 @@
+// Throughput benchmark of traverse_accel on the CPU mapping: builds the BVH of a
+// scene, generates primary, ambient occlusion, diffuse and shadow rays, and
+// reports the number of rays traced per second for each type of ray:
+//   bench [options] scene.obj|scene.ply
+// With --perf, hardware counters are also collected around the timed runs, and
+// reported per ray and per node visited by a ray.
+// When compiled with BENCH_EMBREE (and linked with Embree 2), the same rays are
+// also traced with rtcIntersect8, which uses the BVH4Intersector8Chunk excerpted
+// in embree.cpp, and the hits of both are compared.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "bvh_cache.h"
+#include "mesh.h"
+#include "perf_counters.h"
+#include "rays.h"
+#include "traverse.h"
+
+#ifdef BENCH_EMBREE
+#include <embree2/rtcore.h>
+#include <embree2/rtcore_ray.h>
+#endif
+
+static void usage(const char* name) {
+    std::fprintf(stderr,
+        "usage: %s [options] scene.obj|scene.ply\n"
+        "options:\n"
+        "  --width n        width of the image (default 1024)\n"
+        "  --height n       height of the image (default 1024)\n"
+        "  --warmup n       number of untimed runs (default 2)\n"
+        "  --repeats n      number of timed runs, the best one is reported (default 10)\n"
+        "  --threads n      number of threads of the traversal (default: all cores)\n"
+        "  --ao-radius r    length of the AO rays, relative to the scene diagonal (default 0.1)\n"
+        "  --builder b      sah or lbvh (default sah)\n"
+        "  --spatial b      spatial split budget of the SAH builder (default 0)\n"
+        "  --perf           collects hardware counters during the timed runs\n"
+        "  --indexed        traces the leaves of tri_cpu_indexed.impala instead of tri_cpu.impala\n"
+        "                   (the traversal must be compiled with the same file)\n"
+        "  --woop           traces the Woop triangle blocks of emit_bvh4_woop\n"
+        "                   (the traversal must be compiled with woop_triangles set)\n"
+        "  --cache file     loads the BVH from a cache file, or builds it and writes the\n"
+        "                   cache when the file is missing or was built with other settings\n"
+#ifdef BENCH_EMBREE
+        "  --embree         also trace the rays with Embree and compare the hits\n"
+#endif
+        , name);
+}
+
+struct Timing {
+    double best_ms;
+    double mrays;
+    double counts[perf_event_count];    // per run
+};
+
+// When perf is not null, its counters are averaged over the timed runs (per run)
+template <typename F>
+static Timing measure(int ray_count, int warmup, int repeats, PerfCounters* perf, F trace) {
+    for (int i = 0; i < warmup; i++) trace();
+
+    Timing timing = {};
+    double best = 1.0e+30;
+    for (int i = 0; i < repeats; i++) {
+        if (perf) perf->start();
+        auto start = std::chrono::high_resolution_clock::now();
+        trace();
+        auto end = std::chrono::high_resolution_clock::now();
+        if (perf) {
+            perf->stop();
+            for (int k = 0; k < perf_event_count; k++) timing.counts[k] += perf->read(PerfEvent(k)) / repeats;
+        }
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    timing.best_ms = best;
+    timing.mrays = ray_count / best * 1.0e-3;
+    return timing;
+}
+
+// Prints the counters of one run per ray and per node visit, which tells
+// whether the traversal waits on memory (misses per node) or on computations
+// (instructions per cycle)
+static void print_perf(const PerfCounters& perf, const Timing& timing, int ray_count, long long node_visits) {
+    std::printf("         per ray:");
+    for (int k = 0; k < perf_event_count; k++) {
+        if (perf.available(PerfEvent(k))) std::printf(" %s %.2f,", PerfCounters::name(PerfEvent(k)), timing.counts[k] / ray_count);
+    }
+    if (perf.available(perf_cycles) && perf.available(perf_instructions) && timing.counts[perf_cycles] > 0) {
+        std::printf(" IPC %.2f", timing.counts[perf_instructions] / timing.counts[perf_cycles]);
+    }
+    std::printf("\n         per node visit:");
+    for (int k = 0; k < perf_event_count; k++) {
+        if (perf.available(PerfEvent(k))) std::printf(" %s %.3f,", PerfCounters::name(PerfEvent(k)), node_visits ? timing.counts[k] / node_visits : 0.0);
+    }
+    std::printf(" (%.2f nodes per ray)\n", static_cast<double>(node_visits) / ray_count);
+}
+
+// Prints the traversal counters of one run, when they are compiled in
+static void print_traversal_stats(const TraverseStats& stats) {
+    unsigned long long visits = 0, lanes = 0;
+    for (int i = 0; i <= 16; i++) {
+        visits += stats.active_lanes[i];
+        lanes += i * stats.active_lanes[i];
+    }
+    std::printf("         nodes: %llu, leaves: %llu, triangle tests: %llu, stack depth: %llu, active lanes: %.2f/%d\n",
+                stats.nodes, stats.leaves, stats.tri_tests, stats.max_depth,
+                visits ? static_cast<double>(lanes) / visits : 0.0, traverse_packet_size());
+}
+
+#ifdef BENCH_EMBREE
+struct Embree {
+    RTCDevice device;
+    RTCScene scene;
+
+    explicit Embree(const TriMesh& mesh) {
+        // Same layout as the CPU mapping: BVH4 with blocks of 4 triangles
+        device = rtcNewDevice("tri_accel=bvh4.triangle4");
+        scene = rtcDeviceNewScene(device, RTC_SCENE_STATIC, RTC_INTERSECT8);
+        int vertex_count = mesh.vertices.size() / 3;
+        unsigned geom = rtcNewTriangleMesh(scene, RTC_GEOMETRY_STATIC, mesh.tri_count(), vertex_count);
+        float* vertices = static_cast<float*>(rtcMapBuffer(scene, geom, RTC_VERTEX_BUFFER));
+        for (int i = 0; i < vertex_count; i++) {
+            for (int k = 0; k < 3; k++) vertices[4 * i + k] = mesh.vertices[3 * i + k];
+            vertices[4 * i + 3] = 0.0f;
+        }
+        rtcUnmapBuffer(scene, geom, RTC_VERTEX_BUFFER);
+        int* indices = static_cast<int*>(rtcMapBuffer(scene, geom, RTC_INDEX_BUFFER));
+        std::copy(mesh.indices.begin(), mesh.indices.end(), indices);
+        rtcUnmapBuffer(scene, geom, RTC_INDEX_BUFFER);
+        rtcCommit(scene);
+    }
+
+    ~Embree() {
+        rtcDeleteScene(scene);
+        rtcDeleteDevice(device);
+    }
+
+    // Writes the mesh triangle that is hit in tri_id
+    void trace(const std::vector<Ray>& rays, std::vector<Hit>& hits) {
+        for (size_t i = 0; i < rays.size(); i += 8) {
+            RTCRay8 packet;
+            // rtcIntersect8 requires a 32-byte aligned mask (RTCRay8 is aligned by its type)
+            alignas(32) int valid[8];
+            for (int j = 0; j < 8; j++) {
+                const Ray& ray = rays[std::min(i + j, rays.size() - 1)];
+                valid[j] = i + j < rays.size() ? -1 : 0;
+                packet.orgx[j] = ray.org.x; packet.orgy[j] = ray.org.y; packet.orgz[j] = ray.org.z;
+                packet.dirx[j] = ray.dir.x; packet.diry[j] = ray.dir.y; packet.dirz[j] = ray.dir.z;
+                packet.tnear[j] = ray.org.w;
+                packet.tfar[j] = ray.dir.w;
+                packet.time[j] = 0.0f;
+                packet.mask[j] = -1;
+                packet.geomID[j] = RTC_INVALID_GEOMETRY_ID;
+                packet.primID[j] = RTC_INVALID_GEOMETRY_ID;
+                packet.instID[j] = RTC_INVALID_GEOMETRY_ID;
+            }
+            rtcIntersect8(valid, scene, packet);
+            for (int j = 0; j < 8 && i + j < rays.size(); j++) {
+                bool hit = packet.geomID[j] != RTC_INVALID_GEOMETRY_ID;
+                hits[i + j] = Hit{hit ? static_cast<int>(packet.primID[j]) : -1, packet.tfar[j], packet.u[j], packet.v[j]};
+            }
+        }
+    }
+};
+
+// Counts the rays for which only one of the traversals finds a hit, or that
+// hit at a different distance
+static int compare_hits(const std::vector<int>& tri_ids, const std::vector<Hit>& hits,
+                        const std::vector<Hit>& embree_hits, int ray_count) {
+    int mismatches = 0;
+    for (int i = 0; i < ray_count; i++) {
+        bool hit = hits[i].tri_id >= 0;
+        bool embree_hit = embree_hits[i].tri_id >= 0;
+        if (hit != embree_hit) {
+            mismatches++;
+        } else if (hit && tri_ids[hits[i].tri_id] != embree_hits[i].tri_id &&
+                   std::fabs(hits[i].tmax - embree_hits[i].tmax) > 1.0e-4f * std::max(1.0f, embree_hits[i].tmax)) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+#endif
+
+// Builds the BVH, prints its statistics, and with indexed, replaces the leaves
+// with the indexed ones (both layouts share the same tree)
+static void build_bvh(const TriMesh& mesh, const BuildOptions& options, const std::string& builder,
+                      bool indexed, bool woop, Bvh4& bvh) {
+    auto start = std::chrono::high_resolution_clock::now();
+    BuildTree tree;
+    if (builder == "lbvh") {
+        build_lbvh(mesh, options, tree);
+        optimize_treelets(options, tree);
+    } else {
+        build_sah(mesh, options, tree);
+    }
+    if (woop)
+        emit_bvh4_woop(mesh, tree, bvh);
+    else
+        emit_bvh4(mesh, tree, bvh);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    BuildStats stats;
+    stats.build_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    compute_stats(bvh, options, stats);
+    print_stats(stdout, stats);
+
+    Bvh4i ibvh;
+    if (indexed) emit_bvh4_indexed(mesh, tree, ibvh);
+    std::printf("leaf data: %.1f MB precomputed", bvh.tris.size() * sizeof(Vec4) * 1.0e-6);
+    if (indexed) std::printf(", %.1f MB indexed (with the vertices)", ibvh.tris.size() * sizeof(Vec4) * 1.0e-6);
+    std::printf("\n");
+    if (indexed) {
+        bvh.nodes.swap(ibvh.nodes);
+        bvh.tris.swap(ibvh.tris);
+        bvh.tri_ids.swap(ibvh.tri_ids);
+    }
+}
+
+int main(int argc, char** argv) {
+    BuildOptions options;
+    std::string builder = "sah";
+    int width = 1024, height = 1024;
+    int warmup = 2, repeats = 10;
+    int threads = 0;
+    float ao_radius = 0.1f;
+    bool use_embree = false;
+    bool use_perf = false;
+    bool indexed = false;
+    bool woop = false;
+    const char* cache_file = nullptr;
+    const char* scene = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_arg = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--width") && has_arg) {
+            width = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--height") && has_arg) {
+            height = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--warmup") && has_arg) {
+            warmup = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--repeats") && has_arg) {
+            repeats = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--threads") && has_arg) {
+            threads = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--ao-radius") && has_arg) {
+            ao_radius = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--builder") && has_arg) {
+            builder = argv[++i];
+        } else if (!std::strcmp(argv[i], "--spatial") && has_arg) {
+            options.spatial_split_budget = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--perf")) {
+            use_perf = true;
+        } else if (!std::strcmp(argv[i], "--indexed")) {
+            indexed = true;
+        } else if (!std::strcmp(argv[i], "--woop")) {
+            woop = true;
+        } else if (!std::strcmp(argv[i], "--cache") && has_arg) {
+            cache_file = argv[++i];
+#ifdef BENCH_EMBREE
+        } else if (!std::strcmp(argv[i], "--embree")) {
+            use_embree = true;
+#endif
+        } else if (argv[i][0] != '-' && !scene) {
+            scene = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!scene || width < 1 || height < 1 || repeats < 1 || warmup < 0 || (indexed && woop) ||
+        (builder != "sah" && builder != "lbvh")) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    TriMesh mesh;
+    if (!load_scene(scene, mesh)) {
+        std::fprintf(stderr, "cannot load %s\n", scene);
+        return 1;
+    }
+    std::printf("%d triangles\n", mesh.tri_count());
+
+    auto start = std::chrono::high_resolution_clock::now();
+    Bvh4 bvh;
+    BvhCache cache;
+    BvhCacheKey key;
+    key.mesh_hash = cache_file ? hash_mesh(mesh) : 0;
+    key.layout = (indexed ? bvh_layout_indexed : 0) | (woop ? bvh_layout_woop : 0);
+    key.builder = builder == "lbvh" ? bvh_builder_lbvh : bvh_builder_sah;
+    key.options = options;
+    if (cache_file && cache.open(cache_file, key)) {
+        // The hit ids are only read by the benchmark, the buffers of the
+        // traversal stay in the mapping. The time includes the hash of the mesh.
+        bvh.tri_ids.assign(cache.tri_ids(), cache.tri_ids() + cache.tri_id_count());
+        auto end = std::chrono::high_resolution_clock::now();
+        std::printf("loaded %s in %.2f ms\n", cache_file, std::chrono::duration<double, std::milli>(end - start).count());
+    } else {
+        build_bvh(mesh, options, builder, indexed, woop, bvh);
+        if (cache_file && !write_bvh_cache(cache_file, key, mesh, bvh))
+            std::fprintf(stderr, "cannot write %s\n", cache_file);
+    }
+    const void* nodes = cache.is_open() ? cache.nodes() : bvh.nodes.data();
+    const void* tris = cache.is_open() ? static_cast<const void*>(cache.tris()) : bvh.tris.data();
+
+    // The counters must be opened before the first traversal starts its threads
+    PerfCounters perf;
+    PerfCounters* counters = nullptr;
+    if (use_perf) {
+        if (perf.open()) {
+            counters = &perf;
+        } else {
+            std::fprintf(stderr, "hardware counters are not available (see /proc/sys/kernel/perf_event_paranoid)\n");
+        }
+    }
+
+    traverse_set_thread_count(threads);
+
+#ifdef BENCH_EMBREE
+    Embree* embree = use_embree ? new Embree(mesh) : nullptr;
+#else
+    (void)use_embree;
+#endif
+
+    std::vector<Ray> primary;
+    generate_primary_rays(mesh, width, height, primary);
+    int primary_count = pad_rays(primary);
+    std::vector<Hit> primary_hits(primary.size());
+    traverse_accel(nodes, primary.data(), tris, primary_hits.data(), primary.size());
+    primary_hits.resize(primary_count);
+
+    struct Batch {
+        const char* name;
+        std::vector<Ray> rays;
+    };
+    Batch batches[4] = { { "primary", primary }, { "ao", {} }, { "diffuse", {} }, { "shadow", {} } };
+    batches[0].rays.resize(primary_count);
+    generate_secondary_rays(mesh, bvh.tri_ids, batches[0].rays, primary_hits, SecondaryRays::ao, ao_radius, 1, batches[1].rays);
+    generate_secondary_rays(mesh, bvh.tri_ids, batches[0].rays, primary_hits, SecondaryRays::diffuse, ao_radius, 2, batches[2].rays);
+    generate_secondary_rays(mesh, bvh.tri_ids, batches[0].rays, primary_hits, SecondaryRays::shadow, ao_radius, 3, batches[3].rays);
+
+    std::printf("type          rays      hits     ms      Mrays/s");
+#ifdef BENCH_EMBREE
+    if (embree) std::printf("  embree Mrays/s  mismatches");
+#endif
+    std::printf("\n");
+
+    for (auto& batch : batches) {
+        int ray_count = pad_rays(batch.rays);
+        std::vector<Hit> hits(batch.rays.size());
+        Timing timing = measure(ray_count, warmup, repeats, counters, [&] {
+            traverse_accel(nodes, batch.rays.data(), tris, hits.data(), batch.rays.size());
+        });
+
+        int hit_count = 0;
+        for (int i = 0; i < ray_count; i++) hit_count += hits[i].tri_id >= 0;
+        std::printf("%-8s %9d %9d %9.2f %10.2f", batch.name, ray_count, hit_count, timing.best_ms, timing.mrays);
+
+#ifdef BENCH_EMBREE
+        if (embree) {
+            std::vector<Hit> embree_hits(batch.rays.size());
+            Timing embree_timing = measure(ray_count, warmup, repeats, nullptr, [&] { embree->trace(batch.rays, embree_hits); });
+            std::printf(" %15.2f %11d", embree_timing.mrays, compare_hits(bvh.tri_ids, hits, embree_hits, ray_count));
+        }
+#endif
+        std::printf("\n");
+
+        // One more run for the statistics, so that they do not include the warm-up
+        TraverseStats stats;
+        traverse_reset_stats();
+        traverse_accel(nodes, batch.rays.data(), tris, hits.data(), batch.rays.size());
+        if (traverse_read_stats(&stats)) print_traversal_stats(stats);
+
+        if (counters) {
+            std::vector<TraverseCost> costs(batch.rays.size());
+            traverse_accel_cost(nodes, batch.rays.data(), tris, hits.data(), costs.data(), batch.rays.size());
+            long long node_visits = 0;
+            for (int i = 0; i < ray_count; i++) node_visits += costs[i].nodes;
+            print_perf(perf, timing, ray_count, node_visits);
+        }
+    }
+
+#ifdef BENCH_EMBREE
+    delete embree;
+#endif
+    perf.close();
+    cache.close();
+    return 0;
+}
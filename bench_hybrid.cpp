@@ -0,0 +1,99 @@
+// Measures the throughput of traverse_accel on the CPU mapping for each single
+// ray threshold, from 0 (packets only) to the packet width (a packet is
+// finished one ray at a time as soon as one of its rays is done):
+//   bench_hybrid nodes.bin tris.bin rays.bin [packet_size] [threads] [repeats]
+// When the traversal is compiled with collect_stats, the average number of
+// active lanes per node visit of the packets is also reported for each
+// threshold, which shows the occupancy that the switch trades for throughput.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "traverse.h"
+
+struct Ray { float org[4]; float dir[4]; };
+struct Hit { int tri_id; float tmax, u, v; };
+
+// Pad to whole words of occlusion bits, which is a multiple of every packet width
+static const int padding = 32;
+
+static bool read_file(const char* name, std::vector<char>& data) {
+    std::ifstream is(name, std::ios::binary);
+    if (!is) return false;
+    is.seekg(0, std::ios::end);
+    data.resize(is.tellg());
+    is.seekg(0, std::ios::beg);
+    return static_cast<bool>(is.read(data.data(), data.size()));
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::fprintf(stderr, "usage: %s nodes.bin tris.bin rays.bin [packet_size] [threads] [repeats]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<char> nodes, tris, ray_data;
+    if (!read_file(argv[1], nodes) || !read_file(argv[2], tris) || !read_file(argv[3], ray_data)) {
+        std::fprintf(stderr, "cannot read input files\n");
+        return 1;
+    }
+
+    int packet_size = argc > 4 ? std::atoi(argv[4]) : 8;
+    int threads = argc > 5 ? std::atoi(argv[5]) : 0;
+    int repeats = argc > 6 ? std::atoi(argv[6]) : 10;
+    packet_size = std::max(packet_size, 1);
+    repeats = std::max(repeats, 1);
+
+    int ray_count = ray_data.size() / sizeof(Ray);
+    int padded_count = (ray_count + padding - 1) / padding * padding;
+    std::vector<Ray> rays(padded_count);
+    std::memcpy(rays.data(), ray_data.data(), ray_count * sizeof(Ray));
+    for (int i = ray_count; i < padded_count; i++) {
+        rays[i] = Ray{{0, 0, 0, 1}, {1, 1, 1, 0}};
+    }
+    std::vector<Hit> hits(padded_count);
+
+    traverse_set_thread_count(threads);
+    std::printf("%d rays, %d repeats\n", ray_count, repeats);
+    std::printf("threshold     Mrays/s    speedup  active lanes  packet visits\n");
+
+    double base = 0;
+    for (int threshold = 0; threshold <= packet_size; threshold++) {
+        traverse_set_single_ray_threshold(threshold);
+        traverse_accel(nodes.data(), rays.data(), tris.data(), hits.data(), padded_count);
+
+        double best = 0;
+        for (int i = 0; i < repeats; i++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            traverse_accel(nodes.data(), rays.data(), tris.data(), hits.data(), padded_count);
+            auto end = std::chrono::high_resolution_clock::now();
+            double secs = std::chrono::duration<double>(end - start).count();
+            best = std::max(best, ray_count / secs * 1.0e-6);
+        }
+
+        if (threshold == 0) base = best;
+        std::printf("%9d %11.2f %10.2f", threshold, best, best / base);
+
+        // One more run for the occupancy: the counters stop at the switch, so
+        // they only cover the node visits made by whole packets
+        TraverseStats stats;
+        traverse_reset_stats();
+        traverse_accel(nodes.data(), rays.data(), tris.data(), hits.data(), padded_count);
+        if (traverse_read_stats(&stats)) {
+            unsigned long long visits = 0, lanes = 0;
+            for (int i = 0; i <= 16; i++) {
+                visits += stats.active_lanes[i];
+                lanes += i * stats.active_lanes[i];
+            }
+            std::printf(" %8.2f/%-4d %14llu\n", visits ? static_cast<double>(lanes) / visits : 0.0, packet_size, visits);
+        } else {
+            std::printf("             -              -\n");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Measures the scaling of traverse_accel from 1 to N threads on the CPU mapping.
+// The inputs are raw dumps of the buffers passed to traverse_accel:
+//   bench_threads nodes.bin tris.bin rays.bin [max_threads] [repeats]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    void traverse_set_thread_count(int count);
+    void traverse_accel(const void* nodes, const void* rays, const void* tris, void* hits, int ray_count);
+}
+
+struct Ray { float org[4]; float dir[4]; };
+struct Hit { int tri_id; float tmax, u, v; };
+
+// Pad to whole words of occlusion bits, which is a multiple of every packet width
+static const int packet_size = 32;
+
+static bool read_file(const char* name, std::vector<char>& data) {
+    std::ifstream is(name, std::ios::binary);
+    if (!is) return false;
+    is.seekg(0, std::ios::end);
+    data.resize(is.tellg());
+    is.seekg(0, std::ios::beg);
+    return static_cast<bool>(is.read(data.data(), data.size()));
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::fprintf(stderr, "usage: %s nodes.bin tris.bin rays.bin [max_threads] [repeats]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<char> nodes, tris, ray_data;
+    if (!read_file(argv[1], nodes) || !read_file(argv[2], tris) || !read_file(argv[3], ray_data)) {
+        std::fprintf(stderr, "cannot read input files\n");
+        return 1;
+    }
+
+    int max_threads = argc > 4 ? std::atoi(argv[4]) : static_cast<int>(std::thread::hardware_concurrency());
+    int repeats = argc > 5 ? std::atoi(argv[5]) : 10;
+    max_threads = std::max(max_threads, 1);
+    repeats = std::max(repeats, 1);
+
+    // Pad the ray buffer to a whole number of packets with empty rays
+    int ray_count = ray_data.size() / sizeof(Ray);
+    int padded_count = (ray_count + packet_size - 1) / packet_size * packet_size;
+    std::vector<Ray> rays(padded_count);
+    std::memcpy(rays.data(), ray_data.data(), ray_count * sizeof(Ray));
+    for (int i = ray_count; i < padded_count; i++) {
+        rays[i] = Ray{{0, 0, 0, 1}, {1, 1, 1, 0}};
+    }
+    std::vector<Hit> hits(padded_count);
+
+    std::printf("%d rays, %d repeats\n", ray_count, repeats);
+    std::printf("threads     Mrays/s    speedup\n");
+
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads++) {
+        traverse_set_thread_count(threads);
+
+        // Warm up the caches and the thread pool
+        traverse_accel(nodes.data(), rays.data(), tris.data(), hits.data(), padded_count);
+
+        // Keep the best run, which is the least disturbed by the rest of the system
+        double best = 0;
+        for (int i = 0; i < repeats; i++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            traverse_accel(nodes.data(), rays.data(), tris.data(), hits.data(), padded_count);
+            auto end = std::chrono::high_resolution_clock::now();
+            double secs = std::chrono::duration<double>(end - start).count();
+            best = std::max(best, ray_count / secs * 1.0e-6);
+        }
+
+        if (threads == 1) base = best;
+        std::printf("%7d %11.2f %10.2f\n", threads, best, best / base);
+    }
+
+    return 0;
+}
@@ -0,0 +1,505 @@
+#include <cstring>
+
+#include "bvh.h"
+
+void make_prim_refs(const TriMesh& mesh, std::vector<PrimRef>& refs) {
+    refs.resize(mesh.tri_count());
+    for (int i = 0; i < mesh.tri_count(); i++) {
+        refs[i].bbox = mesh.tri_bbox(i);
+        refs[i].id = i;
+    }
+}
+
+static void set_child_bbox(Node4& node, int i, const BBox& bbox) {
+    node.min_x[i] = bbox.min[0]; node.min_y[i] = bbox.min[1]; node.min_z[i] = bbox.min[2];
+    node.max_x[i] = bbox.max[0]; node.max_y[i] = bbox.max[1]; node.max_z[i] = bbox.max[2];
+}
+
+static BBox child_bbox(const Node4& node, int i) {
+    return BBox{{node.min_x[i], node.min_y[i], node.min_z[i]},
+                {node.max_x[i], node.max_y[i], node.max_z[i]}};
+}
+
+void store_tri4(const TriMesh& mesh, int id, Vec4* block, int lane) {
+    const float* v0 = mesh.vertex(id, 0);
+    const float* v1 = mesh.vertex(id, 1);
+    const float* v2 = mesh.vertex(id, 2);
+    float e1[3] = { v0[0] - v1[0], v0[1] - v1[1], v0[2] - v1[2] };
+    float e2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+    float n[3] = {
+        e1[1] * e2[2] - e1[2] * e2[1],
+        e1[2] * e2[0] - e1[0] * e2[2],
+        e1[0] * e2[1] - e1[1] * e2[0]
+    };
+
+    float* data = &block->x;
+    for (int k = 0; k < 3; k++) {
+        // The first word of a block is read as the end-of-leaf marker of the
+        // previous block, so -0.0f (0x80000000) must be replaced by 0.0f
+        data[(0 + k) * 4 + lane] = v0[k] == 0.0f ? 0.0f : v0[k];
+        data[(3 + k) * 4 + lane] = e1[k];
+        data[(6 + k) * 4 + lane] = e2[k];
+        data[(9 + k) * 4 + lane] = n[k];
+    }
+}
+
+// Rows of the affine transform from world space to the space in which the
+// triangle is (v0, v1, v2) = (0, 0, 0), (1, 0, 0), (0, 1, 0): rows[0] gives the
+// distance along the normal (with the offset negated, as in aila.cu), rows[1]
+// and rows[2] give the barycentric coordinates u and v of Moeller-Trumbore.
+// Degenerate triangles get null rows, which are never hit.
+static void woop_rows(const TriMesh& mesh, int id, float rows[3][4]) {
+    const float* v0 = mesh.vertex(id, 0);
+    const float* v1 = mesh.vertex(id, 1);
+    const float* v2 = mesh.vertex(id, 2);
+    double a[3], b[3];
+    for (int k = 0; k < 3; k++) {
+        a[k] = double(v1[k]) - v0[k];
+        b[k] = double(v2[k]) - v0[k];
+    }
+    double n[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+    double len2 = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+
+    std::memset(rows, 0, sizeof(float) * 12);
+    if (len2 == 0.0) return;
+
+    // The inverse of the matrix with columns a, b and n = a x b has the rows
+    // (b x n, n x a, n), divided by its determinant |n|^2
+    double inv[3][3] = {
+        { b[1] * n[2] - b[2] * n[1], b[2] * n[0] - b[0] * n[2], b[0] * n[1] - b[1] * n[0] },
+        { n[1] * a[2] - n[2] * a[1], n[2] * a[0] - n[0] * a[2], n[0] * a[1] - n[1] * a[0] },
+        { n[0], n[1], n[2] }
+    };
+    const int order[3] = { 2, 0, 1 };
+    for (int r = 0; r < 3; r++) {
+        const double* row = inv[order[r]];
+        double offset = -(row[0] * v0[0] + row[1] * v0[1] + row[2] * v0[2]) / len2;
+        for (int k = 0; k < 3; k++) rows[r][k] = row[k] / len2;
+        rows[r][3] = r == 0 ? -offset : offset;
+    }
+}
+
+static void store_tri4_woop(const TriMesh& mesh, int id, Vec4* block, int lane) {
+    float rows[3][4];
+    woop_rows(mesh, id, rows);
+
+    float* data = &block->x;
+    for (int r = 0; r < 3; r++) {
+        for (int k = 0; k < 4; k++) data[(4 * r + k) * 4 + lane] = rows[r][k];
+    }
+    // End of leaf marker of the previous block, as in store_tri4
+    if (data[lane] == 0.0f) data[lane] = 0.0f;
+}
+
+typedef void (*StoreTri4)(const TriMesh& mesh, int id, Vec4* block, int lane);
+
+// Emits the triangle blocks of a leaf, and returns the index of the first one
+static int emit_leaf4(const TriMesh& mesh, const BuildTree& tree, const BuildNode& leaf, StoreTri4 store, Bvh4& bvh) {
+    int first = bvh.tris.size();
+    for (int i = 0; i < leaf.ref_count; i += 4) {
+        int block = bvh.tris.size();
+        bvh.tris.resize(block + 12, Vec4{0, 0, 0, 0});
+        bvh.tri_ids.resize(block + 12, -1);
+
+        for (int j = 0; j < 4 && i + j < leaf.ref_count; j++) {
+            int id = tree.refs[leaf.first_ref + i + j];
+            store(mesh, id, &bvh.tris[block], j);
+            bvh.tri_ids[block + j] = id;
+        }
+    }
+
+    // End of leaf marker
+    int marker = 0x80000000;
+    Vec4 end = {0, 0, 0, 0};
+    std::memcpy(&end.x, &marker, sizeof(int));
+    bvh.tris.push_back(end);
+    bvh.tri_ids.push_back(-1);
+    return first;
+}
+
+// Emits a 4-wide node and its subtree: emit_leaf(leaf) stores a leaf and returns
+// the index that its parent references (with a ~)
+template <typename EmitLeaf>
+static int emit_node4(const BuildTree& tree, const BuildNode& build_node, std::vector<Node4>& nodes, EmitLeaf emit_leaf) {
+    // Collapse the binary tree by replacing the largest inner child by its
+    // children, until 4 children are collected
+    int children[4] = { build_node.child, build_node.child + 1 };
+    int child_count = 2;
+    while (child_count < 4) {
+        int largest = -1;
+        float largest_area = -1.0f;
+        for (int i = 0; i < child_count; i++) {
+            const BuildNode& child = tree.nodes[children[i]];
+            if (!child.is_leaf() && child.bbox.half_area() > largest_area) {
+                largest_area = child.bbox.half_area();
+                largest = i;
+            }
+        }
+        if (largest < 0) break;
+
+        int first = tree.nodes[children[largest]].child;
+        children[largest] = first;
+        children[child_count++] = first + 1;
+    }
+
+    int index = nodes.size();
+    nodes.emplace_back();
+    std::memset(&nodes[index], 0, sizeof(Node4));
+    for (int i = 0; i < child_count; i++) {
+        const BuildNode& child = tree.nodes[children[i]];
+        int id = child.is_leaf()
+            ? ~emit_leaf(child)
+            : emit_node4(tree, child, nodes, emit_leaf);
+        set_child_bbox(nodes[index], i, child.bbox);
+        nodes[index].children[i] = id;
+    }
+    return index;
+}
+
+static void emit_bvh4(const TriMesh& mesh, const BuildTree& tree, StoreTri4 store, Bvh4& bvh) {
+    bvh.nodes.clear();
+    bvh.tris.clear();
+    bvh.tri_ids.clear();
+
+    size_t tri_count = 0;
+    for (auto& node : tree.nodes) {
+        if (node.is_leaf()) tri_count += (node.ref_count + 3) / 4 * 12 + 1;
+    }
+    bvh.nodes.reserve(tree.nodes.size() / 2 + 1);
+    bvh.tris.reserve(tri_count);
+    bvh.tri_ids.reserve(tri_count);
+
+    if (tree.nodes.empty() || tree.nodes[0].is_leaf()) {
+        // The traversal always starts with an inner node
+        bvh.nodes.emplace_back();
+        std::memset(&bvh.nodes[0], 0, sizeof(Node4));
+        if (!tree.nodes.empty()) {
+            set_child_bbox(bvh.nodes[0], 0, tree.nodes[0].bbox);
+            bvh.nodes[0].children[0] = ~emit_leaf4(mesh, tree, tree.nodes[0], store, bvh);
+        }
+        return;
+    }
+
+    emit_node4(tree, tree.nodes[0], bvh.nodes, [&] (const BuildNode& leaf) {
+        return emit_leaf4(mesh, tree, leaf, store, bvh);
+    });
+}
+
+void emit_bvh4(const TriMesh& mesh, const BuildTree& tree, Bvh4& bvh) {
+    emit_bvh4(mesh, tree, store_tri4, bvh);
+}
+
+void emit_bvh4_woop(const TriMesh& mesh, const BuildTree& tree, Bvh4& bvh) {
+    emit_bvh4(mesh, tree, store_tri4_woop, bvh);
+}
+
+void emit_tlas(const BuildTree& tree, Tlas& tlas) {
+    tlas.nodes.clear();
+    auto emit_leaf = [&] (const BuildNode& leaf) { return 4 * tree.refs[leaf.first_ref]; };
+
+    if (tree.nodes.empty() || tree.nodes[0].is_leaf()) {
+        tlas.nodes.emplace_back();
+        std::memset(&tlas.nodes[0], 0, sizeof(Node4));
+        if (!tree.nodes.empty()) {
+            set_child_bbox(tlas.nodes[0], 0, tree.nodes[0].bbox);
+            tlas.nodes[0].children[0] = ~emit_leaf(tree.nodes[0]);
+        }
+        return;
+    }
+
+    emit_node4(tree, tree.nodes[0], tlas.nodes, emit_leaf);
+}
+
+// Emits the index blocks of a leaf, and returns the index of the first one (in Vec4)
+static int emit_leaf4_indexed(const TriMesh& mesh, const BuildTree& tree, const BuildNode& leaf, int vertex_base, Bvh4i& bvh) {
+    int first = bvh.tris.size();
+    for (int i = 0; i < leaf.ref_count; i += 4) {
+        int block = bvh.tris.size();
+        bvh.tris.resize(block + 3);
+        bvh.tri_ids.resize(block / 3 * 4 + 4, -1);
+
+        // Padding repeats the first vertex of the block, which gives a
+        // degenerate triangle that is never hit
+        int* indices = reinterpret_cast<int*>(&bvh.tris[block]);
+        int first_vertex = vertex_base + 3 * mesh.indices[3 * tree.refs[leaf.first_ref + i]];
+        for (int j = 0; j < 4; j++) {
+            int id = i + j < leaf.ref_count ? tree.refs[leaf.first_ref + i + j] : -1;
+            for (int k = 0; k < 3; k++)
+                indices[4 * k + j] = id >= 0 ? vertex_base + 3 * mesh.indices[3 * id + k] : first_vertex;
+            bvh.tri_ids[block / 3 * 4 + j] = id;
+        }
+    }
+
+    // End of leaf bit
+    reinterpret_cast<int*>(&bvh.tris[bvh.tris.size() - 3])[0] |= 0x80000000;
+    return first;
+}
+
+void emit_bvh4_indexed(const TriMesh& mesh, const BuildTree& tree, Bvh4i& bvh) {
+    bvh.nodes.clear();
+    bvh.tris.clear();
+    bvh.tri_ids.clear();
+
+    // The vertices follow the blocks, so their offset is known in advance
+    size_t block_count = 0;
+    for (auto& node : tree.nodes) {
+        if (node.is_leaf()) block_count += (node.ref_count + 3) / 4;
+    }
+    int vertex_base = block_count * 12;
+    bvh.nodes.reserve(tree.nodes.size() / 2 + 1);
+    bvh.tris.reserve(block_count * 3 + (mesh.vertices.size() + 3) / 4);
+    bvh.tri_ids.reserve(block_count * 4);
+
+    auto emit_leaf = [&] (const BuildNode& leaf) {
+        return emit_leaf4_indexed(mesh, tree, leaf, vertex_base, bvh);
+    };
+    if (tree.nodes.empty() || tree.nodes[0].is_leaf()) {
+        bvh.nodes.emplace_back();
+        std::memset(&bvh.nodes[0], 0, sizeof(Node4));
+        if (!tree.nodes.empty()) {
+            set_child_bbox(bvh.nodes[0], 0, tree.nodes[0].bbox);
+            bvh.nodes[0].children[0] = ~emit_leaf(tree.nodes[0]);
+        }
+    } else {
+        emit_node4(tree, tree.nodes[0], bvh.nodes, emit_leaf);
+    }
+
+    bvh.tris.resize(block_count * 3 + (mesh.vertices.size() + 3) / 4, Vec4{0, 0, 0, 0});
+    if (!mesh.vertices.empty())
+        std::memcpy(&bvh.tris[block_count * 3], mesh.vertices.data(), mesh.vertices.size() * sizeof(float));
+}
+
+static BBox2 to_bbox2(const BBox& bbox) {
+    return BBox2{bbox.min[0], bbox.max[0], bbox.min[1], bbox.max[1], bbox.min[2], bbox.max[2]};
+}
+
+// Emits the triangles of a leaf, and returns the index of the first one
+static int emit_leaf2(const TriMesh& mesh, const BuildTree& tree, const BuildNode& leaf, Bvh2& bvh) {
+    int first = bvh.tris.size();
+    for (int i = 0; i < leaf.ref_count; i++) {
+        int id = tree.refs[leaf.first_ref + i];
+        bvh.tri_ids.push_back(id);
+        bvh.tri_ids.push_back(-1);
+        bvh.tri_ids.push_back(-1);
+        for (int j = 0; j < 3; j++) {
+            const float* v = mesh.vertex(id, j);
+            bvh.tris.push_back(Vec4{v[0], v[1], v[2], 0.0f});
+        }
+    }
+    if (leaf.ref_count == 0) {
+        // The marker needs a triangle: a degenerate one, which is never hit
+        bvh.tri_ids.insert(bvh.tri_ids.end(), 3, -1);
+        bvh.tris.insert(bvh.tris.end(), 3, Vec4{0, 0, 0, 0});
+    }
+
+    // End of leaf marker
+    int marker = 0x80000000;
+    std::memcpy(&bvh.tris.back().w, &marker, sizeof(int));
+    return first;
+}
+
+// Same as emit_leaf2, with the Woop transform of each triangle, and the end of
+// leaf marker in the first word of an extra Vec4
+static int emit_leaf2_woop(const TriMesh& mesh, const BuildTree& tree, const BuildNode& leaf, Bvh2& bvh) {
+    int first = bvh.tris.size();
+    for (int i = 0; i < leaf.ref_count; i++) {
+        int id = tree.refs[leaf.first_ref + i];
+        float rows[3][4];
+        woop_rows(mesh, id, rows);
+        // -0.0f would be read as the end of leaf marker
+        if (rows[0][0] == 0.0f) rows[0][0] = 0.0f;
+
+        bvh.tri_ids.push_back(id);
+        bvh.tri_ids.push_back(-1);
+        bvh.tri_ids.push_back(-1);
+        for (int j = 0; j < 3; j++)
+            bvh.tris.push_back(Vec4{rows[j][0], rows[j][1], rows[j][2], rows[j][3]});
+    }
+
+    int marker = 0x80000000;
+    Vec4 end = {0, 0, 0, 0};
+    std::memcpy(&end.x, &marker, sizeof(int));
+    bvh.tris.push_back(end);
+    bvh.tri_ids.push_back(-1);
+    return first;
+}
+
+typedef int (*EmitLeaf2)(const TriMesh& mesh, const BuildTree& tree, const BuildNode& leaf, Bvh2& bvh);
+
+static int emit_node2(const TriMesh& mesh, const BuildTree& tree, const BuildNode& build_node, EmitLeaf2 emit_leaf, Bvh2& bvh) {
+    int index = bvh.nodes.size();
+    bvh.nodes.emplace_back();
+    std::memset(&bvh.nodes[index], 0, sizeof(Node2));
+
+    int ids[2];
+    for (int i = 0; i < 2; i++) {
+        const BuildNode& child = tree.nodes[build_node.child + i];
+        ids[i] = child.is_leaf()
+            ? ~emit_leaf(mesh, tree, child, bvh)
+            : emit_node2(mesh, tree, child, emit_leaf, bvh);
+    }
+
+    Node2& node = bvh.nodes[index];
+    node.left_bb  = to_bbox2(tree.nodes[build_node.child + 0].bbox);
+    node.right_bb = to_bbox2(tree.nodes[build_node.child + 1].bbox);
+    node.left  = ids[0];
+    node.right = ids[1];
+    return index;
+}
+
+static void emit_bvh2(const TriMesh& mesh, const BuildTree& tree, EmitLeaf2 emit_leaf, Bvh2& bvh) {
+    bvh.nodes.clear();
+    bvh.tris.clear();
+    bvh.tri_ids.clear();
+    bvh.nodes.reserve(tree.nodes.size() / 2 + 1);
+    bvh.tris.reserve(tree.refs.size() * 3);
+    bvh.tri_ids.reserve(tree.refs.size() * 3);
+
+    if (tree.nodes.empty() || tree.nodes[0].is_leaf()) {
+        // Both children of the root are the same leaf, since the GPU traversal
+        // always intersects two boxes
+        bvh.nodes.emplace_back();
+        Node2& root = bvh.nodes[0];
+        std::memset(&root, 0, sizeof(Node2));
+        if (tree.nodes.empty()) {
+            // The slab test hits inverted boxes, so the children must be a
+            // real leaf: an empty one, which the ray goes through
+            BuildNode empty = { BBox::empty(), 0, 0, 0 };
+            root.left_bb = root.right_bb = to_bbox2(BBox::empty());
+            root.left = root.right = ~emit_leaf(mesh, tree, empty, bvh);
+            return;
+        }
+        root.left_bb = root.right_bb = to_bbox2(tree.nodes[0].bbox);
+        root.left = root.right = ~emit_leaf(mesh, tree, tree.nodes[0], bvh);
+        return;
+    }
+
+    emit_node2(mesh, tree, tree.nodes[0], emit_leaf, bvh);
+}
+
+void emit_bvh2(const TriMesh& mesh, const BuildTree& tree, Bvh2& bvh) {
+    emit_bvh2(mesh, tree, emit_leaf2, bvh);
+}
+
+void emit_bvh2_woop(const TriMesh& mesh, const BuildTree& tree, Bvh2& bvh) {
+    emit_bvh2(mesh, tree, emit_leaf2_woop, bvh);
+}
+
+static int leaf_block_count(const Bvh4& bvh, int leaf) {
+    int count = 1, marker;
+    for (int i = ~leaf; ; i += 12, count++) {
+        std::memcpy(&marker, &bvh.tris[i + 12].x, sizeof(int));
+        if (marker == static_cast<int>(0x80000000)) break;
+    }
+    return count;
+}
+
+namespace {
+
+struct Bvh4Walker {
+    const Bvh4& bvh;
+    float inner_area, leaf_area;
+    int leaf_count;
+
+    void walk(int node_id, float area) {
+        const Node4& node = bvh.nodes[node_id];
+        inner_area += area;
+        for (int i = 0; i < 4 && node.children[i] != 0; i++) {
+            float child_area = child_bbox(node, i).half_area();
+            if (node.children[i] < 0) {
+                leaf_area += child_area * leaf_block_count(bvh, node.children[i]);
+                leaf_count++;
+            } else {
+                walk(node.children[i], child_area);
+            }
+        }
+    }
+
+    static Bvh4Walker run(const Bvh4& bvh, float root_area) {
+        Bvh4Walker walker = { bvh, 0.0f, 0.0f, 0 };
+        if (!bvh.nodes.empty()) walker.walk(0, root_area);
+        return walker;
+    }
+};
+
+} // namespace
+
+static float root_area(const Bvh4& bvh) {
+    BBox bbox = BBox::empty();
+    for (int i = 0; i < 4 && bvh.nodes[0].children[i] != 0; i++)
+        bbox.extend(child_bbox(bvh.nodes[0], i));
+    return bbox.half_area();
+}
+
+float sah_cost(const Bvh4& bvh, const BuildOptions& options) {
+    if (bvh.nodes.empty()) return 0.0f;
+    float area = root_area(bvh);
+    if (area <= 0.0f) return 0.0f;
+
+    Bvh4Walker walker = Bvh4Walker::run(bvh, area);
+    return (options.trav_cost * walker.inner_area + options.int_cost * walker.leaf_area) / area;
+}
+
+// The GPU traversal intersects triangles one by one, so the intersection cost
+// of a block of 4 triangles is split evenly between them
+static float walk_bvh2(const Bvh2& bvh, int node_id, float area, const BuildOptions& options, int& leaf_count) {
+    const Node2& node = bvh.nodes[node_id];
+    float cost = options.trav_cost * area;
+    const BBox2* bboxes[2] = { &node.left_bb, &node.right_bb };
+    int children[2] = { node.left, node.right };
+    // The root of a tree with a single leaf references it twice (see emit_bvh2)
+    int child_count = node.left == node.right ? 1 : 2;
+    for (int i = 0; i < child_count; i++) {
+        const BBox2& b = *bboxes[i];
+        float dx = b.hi_x - b.lo_x, dy = b.hi_y - b.lo_y, dz = b.hi_z - b.lo_z;
+        float child_area = dx < 0.0f || dy < 0.0f || dz < 0.0f ? 0.0f : dx * dy + dy * dz + dz * dx;
+        if (children[i] < 0) {
+            int tri_count = 1, marker;
+            for (int j = ~children[i]; ; j += 3, tri_count++) {
+                std::memcpy(&marker, &bvh.tris[j + 2].w, sizeof(int));
+                if (marker == static_cast<int>(0x80000000)) break;
+            }
+            cost += options.int_cost * 0.25f * child_area * tri_count;
+            leaf_count++;
+        } else {
+            cost += walk_bvh2(bvh, children[i], child_area, options, leaf_count);
+        }
+    }
+    return cost;
+}
+
+float sah_cost(const Bvh2& bvh, const BuildOptions& options) {
+    if (bvh.tris.empty()) return 0.0f;
+    BBox bbox = BBox::empty();
+    const Node2& root = bvh.nodes[0];
+    bbox.extend(BBox{{root.left_bb.lo_x, root.left_bb.lo_y, root.left_bb.lo_z}, {root.left_bb.hi_x, root.left_bb.hi_y, root.left_bb.hi_z}});
+    bbox.extend(BBox{{root.right_bb.lo_x, root.right_bb.lo_y, root.right_bb.lo_z}, {root.right_bb.hi_x, root.right_bb.hi_y, root.right_bb.hi_z}});
+    float area = bbox.half_area();
+    if (area <= 0.0f) return 0.0f;
+
+    int leaf_count = 0;
+    return walk_bvh2(bvh, 0, area, options, leaf_count) / area;
+}
+
+void compute_stats(const Bvh2& bvh, const BuildOptions& options, BuildStats& stats) {
+    stats.node_count = bvh.nodes.size();
+    stats.leaf_count = 0;
+    if (!bvh.tris.empty()) walk_bvh2(bvh, 0, 1.0f, options, stats.leaf_count);
+    stats.tri_refs = 0;
+    for (int id : bvh.tri_ids) stats.tri_refs += id >= 0;
+    stats.sah_cost = sah_cost(bvh, options);
+}
+
+void compute_stats(const Bvh4& bvh, const BuildOptions& options, BuildStats& stats) {
+    stats.node_count = bvh.nodes.size();
+    stats.leaf_count = Bvh4Walker::run(bvh, 1.0f).leaf_count;
+    stats.tri_refs = 0;
+    for (int id : bvh.tri_ids) stats.tri_refs += id >= 0;
+    stats.sah_cost = sah_cost(bvh, options);
+}
+
+void print_stats(FILE* fp, const BuildStats& stats) {
+    std::fprintf(fp, "build time: %.2f ms\n", stats.build_ms);
+    std::fprintf(fp, "nodes: %d, leaves: %d, triangle references: %d\n", stats.node_count, stats.leaf_count, stats.tri_refs);
+    std::fprintf(fp, "SAH cost: %.3f\n", stats.sah_cost);
+}
@@ -0,0 +1,278 @@
+// Data structures shared by the BVH builders. The builders produce a binary
+// tree, which is then converted to the buffers read by the traversal mappings.
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstdio>
+#include <vector>
+
+struct Vec4 {
+    float x, y, z, w;
+};
+
+struct BBox {
+    float min[3], max[3];
+
+    static BBox empty() {
+        return BBox{{ 1.0e+37f,  1.0e+37f,  1.0e+37f},
+                    {-1.0e+37f, -1.0e+37f, -1.0e+37f}};
+    }
+
+    void extend(const float* p) {
+        for (int i = 0; i < 3; i++) {
+            if (p[i] < min[i]) min[i] = p[i];
+            if (p[i] > max[i]) max[i] = p[i];
+        }
+    }
+
+    void extend(const BBox& b) {
+        for (int i = 0; i < 3; i++) {
+            if (b.min[i] < min[i]) min[i] = b.min[i];
+            if (b.max[i] > max[i]) max[i] = b.max[i];
+        }
+    }
+
+    bool is_empty() const { return min[0] > max[0] || min[1] > max[1] || min[2] > max[2]; }
+    float center(int axis) const { return (min[axis] + max[axis]) * 0.5f; }
+
+    float half_area() const {
+        if (is_empty()) return 0.0f;
+        float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    int largest_axis() const {
+        float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+        return dx > dy ? (dx > dz ? 0 : 2) : (dy > dz ? 1 : 2);
+    }
+};
+
+// Indexed triangle mesh
+struct TriMesh {
+    std::vector<float> vertices;    // x, y, z for each vertex
+    std::vector<int> indices;       // 3 vertex indices for each triangle
+
+    int tri_count() const { return static_cast<int>(indices.size() / 3); }
+    const float* vertex(int tri, int i) const { return &vertices[3 * indices[3 * tri + i]]; }
+
+    BBox tri_bbox(int tri) const {
+        BBox bbox = BBox::empty();
+        for (int i = 0; i < 3; i++) bbox.extend(vertex(tri, i));
+        return bbox;
+    }
+};
+
+// Triangle reference used during construction
+struct PrimRef {
+    BBox bbox;
+    int id;
+};
+
+// Node of the binary tree produced by the builders: inner nodes have their two
+// children stored next to each other, leaves reference a range of triangles
+struct BuildNode {
+    BBox bbox;
+    int child;          // index of the first child (inner nodes only)
+    int first_ref;      // index of the first triangle in refs (leaves only)
+    int ref_count;      // number of triangles (0 for inner nodes)
+
+    bool is_leaf() const { return ref_count > 0; }
+};
+
+struct BuildTree {
+    std::vector<BuildNode> nodes;   // the root is nodes[0]
+    std::vector<int> refs;          // triangle indices referenced by the leaves
+};
+
+struct BuildOptions {
+    // Defaults are the travCost/intCost constants of Embree's BVH4. The
+    // intersection cost is counted per block of 4 triangles.
+    float trav_cost = 1.0f;
+    float int_cost = 6.0f;
+    int bin_count = 16;
+    int max_leaf_size = 16;
+
+    // Spatial splits (SBVH) in the SAH builder: the budget is the maximum
+    // number of extra triangle references, relative to the number of triangles
+    // (0 disables spatial splits). Spatial splits are only tried when the
+    // children of the best object split overlap by more than alpha times the
+    // area of the root.
+    float spatial_split_budget = 0.0f;
+    float spatial_split_alpha = 1.0e-5f;
+
+    // Linear BVH builder: number of bits of the Morton codes (30 or 63),
+    // maximum number of triangles per leaf, and number of treelet optimization
+    // passes run after the build
+    int morton_bits = 30;
+    int lbvh_leaf_size = 4;
+    int treelet_passes = 0;
+
+    // Number of threads used by the parallel builders (0 for all the cores)
+    int thread_count = 0;
+};
+
+// Layout of mapping_cpu.impala: 4-wide nodes, child ids are node indices for
+// inner nodes, ~(index of the first triangle block in tris) for leaves, and 0
+// for unused slots (which are always at the end)
+struct Node4 {
+    float min_x[4], min_y[4], min_z[4];
+    float max_x[4], max_y[4], max_z[4];
+    int children[4];
+};
+
+// A leaf is a sequence of blocks of 12 Vec4 (v0, e1, e2, n for 4 triangles,
+// with one component of one vector per Vec4), followed by a Vec4 whose first
+// word is 0x80000000. The hit id of a triangle is the index of its block plus
+// its position in the block, and tri_ids maps it back to the mesh (-1 for
+// padding). emit_bvh4_woop replaces the 12 words of a triangle by the 3 rows of
+// its Woop transform, for tri_cpu.impala compiled with woop_triangles.
+struct Bvh4 {
+    std::vector<Node4> nodes;
+    std::vector<Vec4> tris;
+    std::vector<int> tri_ids;
+};
+
+// Layout of tri_cpu_indexed.impala: the nodes of Bvh4, with leaves made of
+// blocks of 3 Vec4 (the vertex indices of v0, v1 and v2 for 4 triangles, with
+// one index per word), and the vertices of the mesh stored after the blocks.
+// An index is the offset of the x component of its vertex, in floats from the
+// start of tris, and the sign bit of the first index marks the last block of a
+// leaf. The hit id of a triangle is 4 times the index of its block (in blocks)
+// plus its position in the block, and tri_ids maps it back to the mesh.
+struct Bvh4i {
+    std::vector<Node4> nodes;
+    std::vector<Vec4> tris;
+    std::vector<int> tri_ids;
+};
+
+// Layout of motion_cpu.impala: 4-wide nodes with the child bounds at the start
+// (key 0) and at the end (key 1) of the frame, interpolated linearly with the
+// time of the ray. Child ids follow Node4.
+struct Node4MB {
+    float bounds[2][6][4];  // for each key: min_x, min_y, min_z, max_x, max_y, max_z
+    int children[4];
+};
+
+// A leaf is a sequence of blocks of 18 Vec4 (v0, e1, e2 for 4 triangles at key
+// 0, then at key 1, with one component per Vec4), followed by a Vec4 whose
+// first word is 0x80000000. Hit ids and tri_ids work as in Bvh4.
+struct Bvh4MB {
+    std::vector<Node4MB> nodes;
+    std::vector<Vec4> tris;
+    std::vector<int> tri_ids;
+};
+
+// Layout of instancing_cpu.impala: an instance is the affine transform from
+// world to object space (3 rows of 4 floats), and the buffers of a Bvh4 that
+// can be shared by any number of instances. It is 4 Vec4 long.
+struct Instance {
+    float world_to_object[12];
+    const Node4* nodes;
+    const Vec4* tris;
+};
+
+// Top-level BVH: a tree of Node4 whose leaves reference a single instance each,
+// as ~(4 * index of the instance), so that like the leaves of a Bvh4 they are
+// indices of Vec4 (the instances are prefetched like triangle blocks)
+struct Tlas {
+    std::vector<Node4> nodes;
+    std::vector<Instance> instances;
+    std::vector<BBox> bboxes;   // world space bounds of each instance
+};
+
+// Layout of node_cpu_quantized.impala: the bounds of child i along axis k are
+// origin[k] + lo[k][i] * 2^exponent[k] and origin[k] + hi[k][i] * 2^exponent[k].
+// The triangle blocks are the same as for Node4.
+struct Node4q {
+    float origin[3];
+    signed char exponent[4];
+    unsigned char lo_x[4], lo_y[4], lo_z[4];
+    unsigned char hi_x[4], hi_y[4], hi_z[4];
+    int children[4];
+};
+
+// Layout of mapping_gpu.impala: 2-wide nodes, with child ids that are node
+// indices for inner nodes, and ~(index of the first triangle in tris) for leaves
+struct BBox2 {
+    float lo_x, hi_x;
+    float lo_y, hi_y;
+    float lo_z, hi_z;
+};
+
+struct Node2 {
+    BBox2 left_bb;
+    BBox2 right_bb;
+    int left, right;
+    int pad0, pad1;
+};
+
+// Triangles are stored as 3 Vec4 (v0, v1, v2), and the w component of v2 is
+// 0x80000000 for the last triangle of a leaf. The hit id of a triangle is the
+// index of its first Vec4, which tri_ids maps back to the mesh.
+// emit_bvh2_woop stores the 3 rows of the Woop transform instead, and ends each
+// leaf with a Vec4 whose first word is 0x80000000, for mapping_gpu.impala
+// compiled with woop_triangles.
+struct Bvh2 {
+    std::vector<Node2> nodes;
+    std::vector<Vec4> tris;
+    std::vector<int> tri_ids;
+};
+
+struct BuildStats {
+    double build_ms;
+    int node_count;
+    int leaf_count;
+    int tri_refs;
+    float sah_cost;
+};
+
+// Binned SAH builder, with optional spatial splits (bvh_sah.cpp)
+void build_sah(const TriMesh& mesh, const BuildOptions& options, BuildTree& tree);
+
+// Builder over precomputed bounding boxes, without spatial splits
+void build_sah(const std::vector<PrimRef>& refs, const BuildOptions& options, BuildTree& tree);
+
+// Parallel linear BVH builder and treelet optimization (bvh_lbvh.cpp)
+void build_lbvh(const TriMesh& mesh, const BuildOptions& options, BuildTree& tree);
+void optimize_treelets(const BuildOptions& options, BuildTree& tree);
+
+// In-place refit (bvh_refit.cpp): recomputes the triangle blocks and the node
+// bounds of a CPU BVH after the vertices of the mesh have moved, and returns
+// the SAH cost of the refitted tree. The topology is kept, so the tree quality
+// degrades with the deformation: comparing the returned cost with the cost of
+// the initial build tells when a full rebuild is worth it. Only the blocks
+// of emit_bvh4 are supported, not the Woop ones.
+float refit_bvh4(const TriMesh& mesh, const BuildOptions& options, Bvh4& bvh);
+
+// Motion blur (bvh_motion.cpp): builds a BVH over the motion of the triangles
+// between two keyframes of a mesh with the same topology. The tree is built on
+// the swept bounds of the triangles, and its bounds are then refitted at each key.
+void build_bvh4_motion(const TriMesh& mesh0, const TriMesh& mesh1, const BuildOptions& options, Bvh4MB& bvh);
+
+// Two-level instancing (bvh_instance.cpp): add_instance places a bottom-level
+// BVH in the scene with the given object to world transform (3 rows of 4
+// floats), and build_tlas builds the top-level BVH over all the instances. The
+// bottom-level BVHs must outlive the Tlas. add_instance returns false, and leaves
+// the Tlas unchanged, when the transform cannot be inverted (e.g. a zero scale).
+bool add_instance(Tlas& tlas, const Bvh4& blas, const float object_to_world[12]);
+void build_tlas(const BuildOptions& options, Tlas& tlas);
+
+// Conservative quantization of the child bounds (bvh_quantize.cpp)
+void quantize_nodes(const std::vector<Node4>& nodes, std::vector<Node4q>& qnodes);
+
+// Conversion to the traversal layouts and statistics (bvh.cpp)
+void make_prim_refs(const TriMesh& mesh, std::vector<PrimRef>& refs);
+void emit_bvh4(const TriMesh& mesh, const BuildTree& tree, Bvh4& bvh);
+void emit_bvh4_woop(const TriMesh& mesh, const BuildTree& tree, Bvh4& bvh);
+void emit_bvh4_indexed(const TriMesh& mesh, const BuildTree& tree, Bvh4i& bvh);
+void store_tri4(const TriMesh& mesh, int id, Vec4* block, int lane);
+void emit_bvh2(const TriMesh& mesh, const BuildTree& tree, Bvh2& bvh);
+void emit_bvh2_woop(const TriMesh& mesh, const BuildTree& tree, Bvh2& bvh);
+void emit_tlas(const BuildTree& tree, Tlas& tlas);
+float sah_cost(const Bvh4& bvh, const BuildOptions& options);
+float sah_cost(const Bvh2& bvh, const BuildOptions& options);
+void compute_stats(const Bvh4& bvh, const BuildOptions& options, BuildStats& stats);
+void compute_stats(const Bvh2& bvh, const BuildOptions& options, BuildStats& stats);
+void print_stats(FILE* fp, const BuildStats& stats);
+
+#endif // BVH_H
@@ -0,0 +1,153 @@
+#include "bvh_cache.h"
+
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char cache_magic[8] = { 'B', 'V', 'H', 'C', 'A', 'C', 'H', 'E' };
+static const uint64_t cache_alignment = 64;
+
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t hash_mesh(const TriMesh& mesh) {
+    // The sizes are hashed too, so that moving the boundary between the two
+    // arrays changes the hash
+    uint64_t sizes[2] = { mesh.vertices.size(), mesh.indices.size() };
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = hash_bytes(hash, sizes, sizeof(sizes));
+    hash = hash_bytes(hash, mesh.vertices.data(), mesh.vertices.size() * sizeof(float));
+    hash = hash_bytes(hash, mesh.indices.data(), mesh.indices.size() * sizeof(int));
+    return hash;
+}
+
+static void set_key(BvhCacheHeader& header, const BvhCacheKey& key) {
+    header.layout = key.layout;
+    header.mesh_hash = key.mesh_hash;
+    header.builder = key.builder;
+    header.trav_cost = key.options.trav_cost;
+    header.int_cost = key.options.int_cost;
+    header.bin_count = key.options.bin_count;
+    header.max_leaf_size = key.options.max_leaf_size;
+    header.spatial_split_budget = key.options.spatial_split_budget;
+    header.spatial_split_alpha = key.options.spatial_split_alpha;
+    header.morton_bits = key.options.morton_bits;
+    header.lbvh_leaf_size = key.options.lbvh_leaf_size;
+    header.treelet_passes = key.options.treelet_passes;
+}
+
+static bool same_key(const BvhCacheHeader& a, const BvhCacheHeader& b) {
+    return a.layout == b.layout && a.mesh_hash == b.mesh_hash && a.builder == b.builder &&
+           a.trav_cost == b.trav_cost && a.int_cost == b.int_cost &&
+           a.bin_count == b.bin_count && a.max_leaf_size == b.max_leaf_size &&
+           a.spatial_split_budget == b.spatial_split_budget && a.spatial_split_alpha == b.spatial_split_alpha &&
+           a.morton_bits == b.morton_bits && a.lbvh_leaf_size == b.lbvh_leaf_size &&
+           a.treelet_passes == b.treelet_passes;
+}
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + cache_alignment - 1) / cache_alignment * cache_alignment;
+}
+
+static bool write_section(FILE* fp, uint64_t& offset, const void* data, size_t size) {
+    static const char zeros[cache_alignment] = {};
+    uint64_t padding = align_offset(offset) - offset;
+    if (std::fwrite(zeros, 1, padding, fp) != padding) return false;
+    if (size > 0 && std::fwrite(data, 1, size, fp) != size) return false;
+    offset += padding + size;
+    return true;
+}
+
+bool write_bvh_cache(const char* file_name, const BvhCacheKey& key, const TriMesh& mesh,
+                     const void* nodes, size_t nodes_size, const void* tris, size_t tris_size,
+                     const int* tri_ids, size_t tri_id_count) {
+    BvhCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = bvh_cache_version;
+    set_key(header, key);
+
+    BBox bounds = BBox::empty();
+    for (size_t i = 0; i < mesh.vertices.size(); i += 3) bounds.extend(&mesh.vertices[i]);
+    std::memcpy(header.bounds_min, bounds.min, sizeof(bounds.min));
+    std::memcpy(header.bounds_max, bounds.max, sizeof(bounds.max));
+
+    size_t tri_ids_size = tri_id_count * sizeof(int);
+    header.nodes   = BvhCacheSection{ align_offset(sizeof(header)), nodes_size };
+    header.tris    = BvhCacheSection{ align_offset(header.nodes.offset + nodes_size), tris_size };
+    header.tri_ids = BvhCacheSection{ align_offset(header.tris.offset + tris_size), tri_ids_size };
+
+    std::string tmp_name = std::string(file_name) + "." + std::to_string(getpid()) + ".tmp";
+    FILE* fp = std::fopen(tmp_name.c_str(), "wb");
+    if (!fp) return false;
+    uint64_t offset = 0;
+    bool ok = write_section(fp, offset, &header, sizeof(header)) &&
+              write_section(fp, offset, nodes, nodes_size) &&
+              write_section(fp, offset, tris, tris_size) &&
+              write_section(fp, offset, tri_ids, tri_ids_size);
+    ok = std::fclose(fp) == 0 && ok;
+    if (ok) ok = std::rename(tmp_name.c_str(), file_name) == 0;
+    if (!ok) std::remove(tmp_name.c_str());
+    return ok;
+}
+
+static bool valid_section(const BvhCacheSection& section, size_t file_size) {
+    return section.offset % cache_alignment == 0 &&
+           section.offset <= file_size && section.size <= file_size - section.offset;
+}
+
+bool BvhCache::open(const char* file_name, const BvhCacheKey& key) {
+    close();
+
+    int fd = ::open(file_name, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(BvhCacheHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    // The mapping is page aligned, so the sections are aligned on 64 bytes in memory
+    size_t file_size = st.st_size;
+    void* ptr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED) return false;
+
+    const BvhCacheHeader& header = *static_cast<const BvhCacheHeader*>(ptr);
+    BvhCacheHeader expected;
+    std::memset(&expected, 0, sizeof(expected));
+    set_key(expected, key);
+    if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 ||
+        header.version != bvh_cache_version || !same_key(header, expected) ||
+        !valid_section(header.nodes, file_size) || !valid_section(header.tris, file_size) ||
+        !valid_section(header.tri_ids, file_size)) {
+        munmap(ptr, file_size);
+        return false;
+    }
+
+    data = ptr;
+    size = file_size;
+    return true;
+}
+
+void BvhCache::close() {
+    if (data) munmap(data, size);
+    data = nullptr;
+    size = 0;
+}
+
+BBox BvhCache::bounds() const {
+    BBox bbox;
+    std::memcpy(bbox.min, header().bounds_min, sizeof(bbox.min));
+    std::memcpy(bbox.max, header().bounds_max, sizeof(bbox.max));
+    return bbox;
+}
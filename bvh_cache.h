@@ -0,0 +1,104 @@
+// On-disk cache of the traversal buffers, to skip the build of static scenes.
+// A cache file is a header followed by the nodes, tris and tri_ids arrays,
+// exactly as emitted for the traversal, each starting at a multiple of 64
+// bytes. The file is mapped with mmap, so the pointers of BvhCache go straight
+// to traverse_accel without any parsing or copy. The header records the
+// layout, the builder and its options, the bounds of the scene, and a hash of
+// the mesh: a cache built from another mesh or with other settings is stale,
+// and is rejected by BvhCache::open.
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "bvh.h"
+
+// Incremented whenever the header or any of the traversal layouts changes
+static const uint32_t bvh_cache_version = 1;
+
+// Layout of the buffers, as flags (0 is the Bvh4 of emit_bvh4)
+enum BvhLayout {
+    bvh_layout_gpu       = 1,   // Bvh2 of emit_bvh2
+    bvh_layout_quantized = 2,   // Node4q of quantize_nodes
+    bvh_layout_indexed   = 4,   // leaves of emit_bvh4_indexed
+    bvh_layout_woop      = 8    // leaves of emit_bvh4_woop or emit_bvh2_woop
+};
+
+enum BvhBuilder {
+    bvh_builder_sah  = 0,
+    bvh_builder_lbvh = 1
+};
+
+// What the cached buffers are built from: the number of threads is left out,
+// since it does not change the result of the builders
+struct BvhCacheKey {
+    uint64_t mesh_hash;
+    uint32_t layout;
+    uint32_t builder;
+    BuildOptions options;
+};
+
+// 64-bit FNV-1a hash of the vertices and indices of a mesh
+uint64_t hash_mesh(const TriMesh& mesh);
+
+struct BvhCacheSection {
+    uint64_t offset;    // in bytes from the start of the file, multiple of 64
+    uint64_t size;      // in bytes
+};
+
+// Layout of the file, in the byte order of the machine (the traversal buffers
+// are stored as they are in memory)
+struct BvhCacheHeader {
+    char magic[8];                  // "BVHCACHE"
+    uint32_t version;
+    uint32_t layout;
+    uint64_t mesh_hash;
+    uint32_t builder;
+    float trav_cost, int_cost;
+    int32_t bin_count, max_leaf_size;
+    float spatial_split_budget, spatial_split_alpha;
+    int32_t morton_bits, lbvh_leaf_size, treelet_passes;
+    float bounds_min[3], bounds_max[3];
+    BvhCacheSection nodes, tris, tri_ids;
+};
+
+// Writes the buffers of a BVH to a temporary file, which is then renamed, so
+// that concurrent readers never see a partial cache
+bool write_bvh_cache(const char* file_name, const BvhCacheKey& key, const TriMesh& mesh,
+                     const void* nodes, size_t nodes_size, const void* tris, size_t tris_size,
+                     const int* tri_ids, size_t tri_id_count);
+
+template <typename Bvh>
+bool write_bvh_cache(const char* file_name, const BvhCacheKey& key, const TriMesh& mesh, const Bvh& bvh) {
+    return write_bvh_cache(file_name, key, mesh,
+                           bvh.nodes.data(), bvh.nodes.size() * sizeof(bvh.nodes[0]),
+                           bvh.tris.data(), bvh.tris.size() * sizeof(Vec4),
+                           bvh.tri_ids.data(), bvh.tri_ids.size());
+}
+
+// Read-only mapping of a cache file, valid until close()
+struct BvhCache {
+    void* data;
+    size_t size;
+
+    BvhCache() : data(nullptr), size(0) {}
+
+    // Fails when the file is missing, truncated, of another version, or was
+    // built for another key
+    bool open(const char* file_name, const BvhCacheKey& key);
+    void close();
+
+    bool is_open() const { return data != nullptr; }
+    const BvhCacheHeader& header() const { return *static_cast<const BvhCacheHeader*>(data); }
+    BBox bounds() const;
+
+    const void* nodes() const { return section(header().nodes); }
+    const Vec4* tris() const { return static_cast<const Vec4*>(section(header().tris)); }
+    const int* tri_ids() const { return static_cast<const int*>(section(header().tri_ids)); }
+    size_t tri_id_count() const { return header().tri_ids.size / sizeof(int); }
+
+    const void* section(const BvhCacheSection& s) const { return static_cast<const char*>(data) + s.offset; }
+};
+
+#endif // BVH_CACHE_H
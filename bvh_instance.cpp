@@ -0,0 +1,96 @@
+// Two-level instancing: the top-level BVH is built with the SAH builder over
+// the world space bounds of the instances, with one instance per leaf, and the
+// traversal moves the rays to object space when it reaches a leaf. Memory
+// scales with the number of distinct meshes instead of the number of instances.
+#include <cmath>
+
+#include "bvh.h"
+
+// The traversal reads an instance as 4 Vec4
+static_assert(sizeof(Instance) == 4 * sizeof(Vec4), "unexpected layout of Instance");
+
+// Inverse of an affine transform: the inverse of the 3x3 part, and the
+// translation moved back through it. Fails when the transform is singular (or
+// so close to it that the inverse overflows).
+static bool invert_affine(const float* m, float* inv) {
+    float a[3][3] = {
+        { m[0], m[1], m[2] },
+        { m[4], m[5], m[6] },
+        { m[8], m[9], m[10] }
+    };
+    float cof[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+            int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            cof[i][j] = a[i1][j1] * a[i2][j2] - a[i1][j2] * a[i2][j1];
+        }
+    }
+    float det = a[0][0] * cof[0][0] + a[0][1] * cof[0][1] + a[0][2] * cof[0][2];
+    float inv_det = 1.0f / det;
+    if (!std::isfinite(inv_det)) return false;
+
+    // The inverse is the transposed cofactor matrix divided by the determinant
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) inv[4 * i + j] = cof[j][i] * inv_det;
+        inv[4 * i + 3] = -(inv[4 * i + 0] * m[3] + inv[4 * i + 1] * m[7] + inv[4 * i + 2] * m[11]);
+    }
+    return true;
+}
+
+// Bounds of the root node of a bottom-level BVH
+static BBox root_bbox(const Bvh4& blas) {
+    BBox bbox = BBox::empty();
+    if (blas.nodes.empty()) return bbox;
+    const Node4& root = blas.nodes[0];
+    for (int i = 0; i < 4 && root.children[i] != 0; i++) {
+        bbox.extend(BBox{{root.min_x[i], root.min_y[i], root.min_z[i]},
+                         {root.max_x[i], root.max_y[i], root.max_z[i]}});
+    }
+    return bbox;
+}
+
+bool add_instance(Tlas& tlas, const Bvh4& blas, const float object_to_world[12]) {
+    Instance instance;
+    if (!invert_affine(object_to_world, instance.world_to_object)) return false;
+    instance.nodes = blas.nodes.data();
+    instance.tris = blas.tris.data();
+    tlas.instances.push_back(instance);
+
+    // The world space bounds enclose the 8 transformed corners of the object
+    BBox object_bbox = root_bbox(blas);
+    BBox world_bbox = BBox::empty();
+    if (!object_bbox.is_empty()) {
+        for (int corner = 0; corner < 8; corner++) {
+            float p[3] = {
+                corner & 1 ? object_bbox.max[0] : object_bbox.min[0],
+                corner & 2 ? object_bbox.max[1] : object_bbox.min[1],
+                corner & 4 ? object_bbox.max[2] : object_bbox.min[2]
+            };
+            float q[3];
+            for (int i = 0; i < 3; i++) {
+                const float* row = &object_to_world[4 * i];
+                q[i] = row[0] * p[0] + row[1] * p[1] + row[2] * p[2] + row[3];
+            }
+            world_bbox.extend(q);
+        }
+    }
+    tlas.bboxes.push_back(world_bbox);
+    return true;
+}
+
+void build_tlas(const BuildOptions& options, Tlas& tlas) {
+    // Instances with empty bounds (empty meshes) are left out of the tree
+    std::vector<PrimRef> refs;
+    for (int i = 0, n = tlas.instances.size(); i < n; i++) {
+        if (!tlas.bboxes[i].is_empty()) refs.push_back(PrimRef{tlas.bboxes[i], i});
+    }
+
+    // One instance per leaf
+    BuildOptions tlas_options = options;
+    tlas_options.max_leaf_size = 1;
+
+    BuildTree tree;
+    build_sah(refs, tlas_options, tree);
+    emit_tlas(tree, tlas);
+}
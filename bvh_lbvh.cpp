@@ -0,0 +1,239 @@
+// Linear BVH builder: triangles are sorted along a Morton curve with a parallel
+// radix sort, and the hierarchy is obtained by splitting ranges of sorted codes
+// at their highest differing bit. The result can then be improved by treelet
+// restructuring (Karras and Aila, "Fast Parallel Construction of High-Quality
+// Bounding Volume Hierarchies").
+#include <atomic>
+
+#include "bvh.h"
+#include "morton.h"
+#include "parallel.h"
+
+namespace {
+
+inline int count_leading_zeros(uint32_t x) { return __builtin_clz(x); }
+inline int count_leading_zeros(uint64_t x) { return __builtin_clzll(x); }
+
+template <typename Key>
+struct LbvhBuilder {
+    const BuildOptions& options;
+    BuildTree& tree;
+    std::vector<PrimRef> refs;
+    std::vector<Key> codes;
+    std::vector<int> order;
+    std::atomic<int> node_count;
+    int thread_count;
+
+    LbvhBuilder(const TriMesh& mesh, const BuildOptions& options, BuildTree& tree)
+        : options(options), tree(tree), node_count(1)
+    {
+        thread_count = options.thread_count > 0 ? options.thread_count : default_thread_count();
+        make_prim_refs(mesh, refs);
+    }
+
+    // Returns the first index of the second half of the range
+    int find_split(int begin, int end) const {
+        Key first = codes[begin], last = codes[end - 1];
+        if (first == last) return (begin + end) / 2;
+
+        // Binary search for the first code that has the highest differing bit set
+        int prefix = count_leading_zeros(first ^ last);
+        int split = begin;
+        int step = end - 1 - begin;
+        do {
+            step = (step + 1) / 2;
+            int next = split + step;
+            if (next < end - 1 && count_leading_zeros(first ^ codes[next]) > prefix)
+                split = next;
+        } while (step > 1);
+        return split + 1;
+    }
+
+    void build(int node, int begin, int end, int depth) {
+        if (end - begin <= std::max(options.lbvh_leaf_size, 1)) {
+            BBox bbox = BBox::empty();
+            for (int i = begin; i < end; i++) bbox.extend(refs[order[i]].bbox);
+            tree.nodes[node] = BuildNode{bbox, 0, begin, end - begin};
+            return;
+        }
+
+        int split = find_split(begin, end);
+        int child = node_count.fetch_add(2);
+        parallel_invoke(depth < spawn_depth(thread_count),
+            [=] { build(child + 0, begin, split, depth + 1); },
+            [=] { build(child + 1, split, end, depth + 1); });
+
+        BBox bbox = tree.nodes[child].bbox;
+        bbox.extend(tree.nodes[child + 1].bbox);
+        tree.nodes[node] = BuildNode{bbox, child, 0, 0};
+    }
+
+    void build() {
+        tree.nodes.clear();
+        tree.refs.clear();
+        if (refs.empty()) return;
+
+        int n = refs.size();
+        std::vector<BBox> bboxes(thread_count, BBox::empty());
+        parallel_ranges(thread_count, 0, n, [&] (int thread, int begin, int end) {
+            for (int i = begin; i < end; i++) {
+                float center[3] = { refs[i].bbox.center(0), refs[i].bbox.center(1), refs[i].bbox.center(2) };
+                bboxes[thread].extend(center);
+            }
+        });
+        BBox centroid_bbox = BBox::empty();
+        for (auto& bbox : bboxes) centroid_bbox.extend(bbox);
+
+        codes.resize(n);
+        order.resize(n);
+        parallel_for(thread_count, 0, n, [&] (int i) {
+            float center[3] = { refs[i].bbox.center(0), refs[i].bbox.center(1), refs[i].bbox.center(2) };
+            codes[i] = morton_code<Key>(center, centroid_bbox);
+            order[i] = i;
+        });
+        radix_sort(thread_count, codes, order);
+
+        // A binary tree with n leaves or less has at most 2n - 1 nodes
+        tree.nodes.resize(2 * n - 1);
+        build(0, 0, n, 0);
+        tree.nodes.resize(node_count);
+
+        tree.refs.resize(n);
+        parallel_for(thread_count, 0, n, [&] (int i) { tree.refs[i] = refs[order[i]].id; });
+    }
+};
+
+// Restructures treelets of up to 7 leaves bottom-up, by finding the topology
+// of minimum SAH cost over every partition of the treelet leaves
+struct TreeletOptimizer {
+    static const int max_leaves = 7;
+
+    const BuildOptions& options;
+    BuildTree& tree;
+    std::vector<float> costs;
+    int thread_count;
+
+    TreeletOptimizer(const BuildOptions& options, BuildTree& tree)
+        : options(options), tree(tree), costs(tree.nodes.size())
+    {
+        thread_count = options.thread_count > 0 ? options.thread_count : default_thread_count();
+    }
+
+    float leaf_cost(const BuildNode& node) const {
+        return options.int_cost * node.bbox.half_area() * ((node.ref_count + 3) / 4);
+    }
+
+    void restructure(int root) {
+        // Grow the treelet by expanding its largest leaf, and keep track of the
+        // pairs of sibling slots that can be reused for the new topology
+        int leaves[max_leaves] = { tree.nodes[root].child, tree.nodes[root].child + 1 };
+        int pairs[max_leaves - 1] = { tree.nodes[root].child };
+        int leaf_count = 2, pair_count = 1;
+        while (leaf_count < max_leaves) {
+            int largest = -1;
+            float largest_area = -1.0f;
+            for (int i = 0; i < leaf_count; i++) {
+                const BuildNode& node = tree.nodes[leaves[i]];
+                if (!node.is_leaf() && node.bbox.half_area() > largest_area) {
+                    largest_area = node.bbox.half_area();
+                    largest = i;
+                }
+            }
+            if (largest < 0) break;
+
+            int child = tree.nodes[leaves[largest]].child;
+            pairs[pair_count++] = child;
+            leaves[largest] = child;
+            leaves[leaf_count++] = child + 1;
+        }
+        if (leaf_count < 3) return;
+
+        // Dynamic programming over the subsets of leaves
+        const int subset_count = 1 << leaf_count;
+        BBox bboxes[1 << max_leaves];
+        float best[1 << max_leaves];
+        int splits[1 << max_leaves];
+        BuildNode leaf_nodes[max_leaves];
+        float leaf_costs[max_leaves];
+        for (int i = 0; i < leaf_count; i++) {
+            leaf_nodes[i] = tree.nodes[leaves[i]];
+            leaf_costs[i] = costs[leaves[i]];
+        }
+
+        for (int s = 1; s < subset_count; s++) {
+            bboxes[s] = BBox::empty();
+            for (int i = 0; i < leaf_count; i++) {
+                if (s & (1 << i)) bboxes[s].extend(leaf_nodes[i].bbox);
+            }
+
+            if ((s & (s - 1)) == 0) {
+                best[s] = leaf_costs[__builtin_ctz(s)];
+                continue;
+            }
+
+            // Only enumerate the partitions where the lowest leaf is on the left
+            float best_cost = 1.0e+37f;
+            int lowest = s & -s;
+            for (int p = (s - 1) & s; p > 0; p = (p - 1) & s) {
+                if (!(p & lowest)) continue;
+                float cost = best[p] + best[s ^ p];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    splits[s] = p;
+                }
+            }
+            best[s] = options.trav_cost * bboxes[s].half_area() + best_cost;
+        }
+
+        if (best[subset_count - 1] >= costs[root]) return;
+
+        int next_pair = 0;
+        place(subset_count - 1, root, bboxes, best, splits, leaf_nodes, leaf_costs, pairs, next_pair);
+    }
+
+    void place(int s, int target, const BBox* bboxes, const float* best, const int* splits,
+               const BuildNode* leaf_nodes, const float* leaf_costs, const int* pairs, int& next_pair) {
+        if ((s & (s - 1)) == 0) {
+            tree.nodes[target] = leaf_nodes[__builtin_ctz(s)];
+            costs[target] = leaf_costs[__builtin_ctz(s)];
+            return;
+        }
+
+        int pair = pairs[next_pair++];
+        place(splits[s], pair + 0, bboxes, best, splits, leaf_nodes, leaf_costs, pairs, next_pair);
+        place(s ^ splits[s], pair + 1, bboxes, best, splits, leaf_nodes, leaf_costs, pairs, next_pair);
+        tree.nodes[target] = BuildNode{bboxes[s], pair, 0, 0};
+        costs[target] = best[s];
+    }
+
+    void optimize(int node, int depth) {
+        const BuildNode& build_node = tree.nodes[node];
+        if (build_node.is_leaf()) {
+            costs[node] = leaf_cost(build_node);
+            return;
+        }
+
+        int child = build_node.child;
+        parallel_invoke(depth < spawn_depth(thread_count),
+            [=] { optimize(child + 0, depth + 1); },
+            [=] { optimize(child + 1, depth + 1); });
+
+        costs[node] = options.trav_cost * build_node.bbox.half_area() + costs[child] + costs[child + 1];
+        restructure(node);
+    }
+};
+
+} // namespace
+
+void build_lbvh(const TriMesh& mesh, const BuildOptions& options, BuildTree& tree) {
+    if (options.morton_bits > 30)
+        LbvhBuilder<uint64_t>(mesh, options, tree).build();
+    else
+        LbvhBuilder<uint32_t>(mesh, options, tree).build();
+}
+
+void optimize_treelets(const BuildOptions& options, BuildTree& tree) {
+    if (tree.nodes.empty()) return;
+    TreeletOptimizer optimizer(options, tree);
+    for (int i = 0; i < options.treelet_passes; i++) optimizer.optimize(0, 0);
+}
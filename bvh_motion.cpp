@@ -0,0 +1,69 @@
+// Motion blur BVH: the topology is built once on the bounds swept by the
+// triangles between the two keys, and the CPU layout is then refitted to each
+// key, so that the traversal can interpolate tight bounds at the time of each
+// ray instead of testing the swept ones.
+#include <cstring>
+
+#include "bvh.h"
+
+// Copies the leaf starting at block of the refitted BVHs to the motion layout,
+// and returns the index of its first block in bvh.tris
+static int emit_leaf4_motion(const Bvh4& key0, const Bvh4& key1, int block, Bvh4MB& bvh) {
+    int first = bvh.tris.size();
+    while (true) {
+        // v0, e1 and e2 of both keys: the normals are recomputed by the traversal
+        for (const Bvh4* key : { &key0, &key1 }) {
+            bvh.tris.insert(bvh.tris.end(), key->tris.begin() + block, key->tris.begin() + block + 9);
+        }
+        bvh.tri_ids.insert(bvh.tri_ids.end(), key0.tri_ids.begin() + block, key0.tri_ids.begin() + block + 4);
+        bvh.tri_ids.resize(bvh.tris.size(), -1);
+
+        int marker;
+        std::memcpy(&marker, &key0.tris[block + 12].x, sizeof(int));
+        if (marker == static_cast<int>(0x80000000)) break;
+        block += 12;
+    }
+
+    int marker = 0x80000000;
+    Vec4 end = {0, 0, 0, 0};
+    std::memcpy(&end.x, &marker, sizeof(int));
+    bvh.tris.push_back(end);
+    bvh.tri_ids.push_back(-1);
+    return first;
+}
+
+void build_bvh4_motion(const TriMesh& mesh0, const TriMesh& mesh1, const BuildOptions& options, Bvh4MB& bvh) {
+    std::vector<PrimRef> refs(mesh0.tri_count());
+    for (int i = 0; i < mesh0.tri_count(); i++) {
+        refs[i].bbox = mesh0.tri_bbox(i);
+        refs[i].bbox.extend(mesh1.tri_bbox(i));
+        refs[i].id = i;
+    }
+
+    BuildTree tree;
+    build_sah(refs, options, tree);
+
+    // Both keys share the topology of the tree
+    Bvh4 key0, key1;
+    emit_bvh4(mesh0, tree, key0);
+    key1 = key0;
+    refit_bvh4(mesh0, options, key0);
+    refit_bvh4(mesh1, options, key1);
+
+    bvh.nodes.resize(key0.nodes.size());
+    bvh.tris.clear();
+    bvh.tri_ids.clear();
+    for (size_t i = 0; i < key0.nodes.size(); i++) {
+        Node4MB& node = bvh.nodes[i];
+        std::memset(&node, 0, sizeof(Node4MB));
+        // The bounds of a Node4 come first, in the same order
+        const Node4* keys[2] = { &key0.nodes[i], &key1.nodes[i] };
+        for (int k = 0; k < 2; k++) {
+            std::memcpy(node.bounds[k], keys[k], sizeof(node.bounds[k]));
+        }
+        for (int j = 0; j < 4; j++) {
+            int child = key0.nodes[i].children[j];
+            node.children[j] = child < 0 ? ~emit_leaf4_motion(key0, key1, ~child, bvh) : child;
+        }
+    }
+}
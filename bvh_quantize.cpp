@@ -0,0 +1,61 @@
+// Conversion of 4-wide nodes to the compressed layout of node_cpu_quantized.impala
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "bvh.h"
+
+// Same computation as in the traversal, so that the rounding is identical
+static float dequantize(float origin, int exponent, int q) {
+    return static_cast<float>(q) * std::ldexp(1.0f, exponent) + origin;
+}
+
+static void quantize_axis(const float* min, const float* max, int child_count, int axis, Node4q& qnode,
+                          unsigned char* lo, unsigned char* hi) {
+    float node_min = min[0], node_max = max[0];
+    for (int i = 1; i < child_count; i++) {
+        node_min = std::min(node_min, min[i]);
+        node_max = std::max(node_max, max[i]);
+    }
+
+    // Smallest power of two such that 255 cells cover the node
+    int exponent = -126;
+    float extent = node_max - node_min;
+    if (extent > 0.0f) {
+        std::frexp(extent / 255.0f, &exponent);
+        exponent = std::max(exponent, -126);
+    }
+    while (exponent < 127 && dequantize(node_min, exponent, 255) < node_max) exponent++;
+
+    qnode.origin[axis] = node_min;
+    qnode.exponent[axis] = exponent;
+    for (int i = 0; i < child_count; i++) {
+        float scale = std::ldexp(1.0f, -exponent);
+        int q_lo = std::max(0,   std::min(255, static_cast<int>(std::floor((min[i] - node_min) * scale))));
+        int q_hi = std::max(0,   std::min(255, static_cast<int>(std::ceil ((max[i] - node_min) * scale))));
+
+        // Round outwards until the dequantized box contains the original one
+        while (q_lo > 0   && dequantize(node_min, exponent, q_lo) > min[i]) q_lo--;
+        while (q_hi < 255 && dequantize(node_min, exponent, q_hi) < max[i]) q_hi++;
+        lo[i] = q_lo;
+        hi[i] = q_hi;
+    }
+}
+
+void quantize_nodes(const std::vector<Node4>& nodes, std::vector<Node4q>& qnodes) {
+    qnodes.resize(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const Node4& node = nodes[i];
+        Node4q& qnode = qnodes[i];
+        std::memset(&qnode, 0, sizeof(Node4q));
+        std::memcpy(qnode.children, node.children, sizeof(node.children));
+
+        int child_count = 0;
+        while (child_count < 4 && node.children[child_count] != 0) child_count++;
+        if (child_count == 0) continue;
+
+        quantize_axis(node.min_x, node.max_x, child_count, 0, qnode, qnode.lo_x, qnode.hi_x);
+        quantize_axis(node.min_y, node.max_y, child_count, 1, qnode, qnode.lo_y, qnode.hi_y);
+        quantize_axis(node.min_z, node.max_z, child_count, 2, qnode, qnode.lo_z, qnode.hi_z);
+    }
+}
@@ -0,0 +1,89 @@
+// In-place refit of the CPU layout: a single bottom-up pass regenerates the
+// precomputed triangles of each leaf from the current vertex positions, and
+// updates the child bounds of each node. Subtrees are processed in parallel.
+#include <cstring>
+
+#include "bvh.h"
+#include "parallel.h"
+
+namespace {
+
+struct Refitter {
+    const TriMesh& mesh;
+    const BuildOptions& options;
+    Bvh4& bvh;
+    int thread_count;
+
+    // Updates a leaf and returns its bounding box, and the number of blocks it contains
+    BBox refit_leaf(int leaf, int& block_count) {
+        BBox bbox = BBox::empty();
+        block_count = 0;
+        for (int block = ~leaf; ; block += 12) {
+            for (int lane = 0; lane < 4; lane++) {
+                int id = bvh.tri_ids[block + lane];
+                if (id < 0) continue;
+                store_tri4(mesh, id, &bvh.tris[block], lane);
+                bbox.extend(mesh.tri_bbox(id));
+            }
+            block_count++;
+
+            int marker;
+            std::memcpy(&marker, &bvh.tris[block + 12].x, sizeof(int));
+            if (marker == static_cast<int>(0x80000000)) break;
+        }
+        return bbox;
+    }
+
+    // Updates the children of a node and returns its bounding box. The SAH
+    // cost of the subtree, not normalized by the area of the root, is added to cost.
+    BBox refit_node(int node_id, int depth, float& cost) {
+        Node4& node = bvh.nodes[node_id];
+        int child_count = 0;
+        while (child_count < 4 && node.children[child_count] != 0) child_count++;
+
+        BBox bboxes[4];
+        float costs[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        auto refit_child = [&] (int i) {
+            int child = node.children[i];
+            if (child < 0) {
+                int block_count;
+                bboxes[i] = refit_leaf(child, block_count);
+                costs[i] = options.int_cost * bboxes[i].half_area() * block_count;
+            } else {
+                bboxes[i] = refit_node(child, depth + 1, costs[i]);
+            }
+        };
+
+        // Nodes have 4 children, so the number of tasks grows twice as fast
+        // as with the binary builders
+        if (depth < spawn_depth(thread_count) / 2) {
+            parallel_for(child_count, 0, child_count, refit_child);
+        } else {
+            for (int i = 0; i < child_count; i++) refit_child(i);
+        }
+
+        BBox bbox = BBox::empty();
+        for (int i = 0; i < child_count; i++) {
+            const BBox& b = bboxes[i];
+            node.min_x[i] = b.min[0]; node.min_y[i] = b.min[1]; node.min_z[i] = b.min[2];
+            node.max_x[i] = b.max[0]; node.max_y[i] = b.max[1]; node.max_z[i] = b.max[2];
+            bbox.extend(b);
+            cost += costs[i];
+        }
+        cost += options.trav_cost * bbox.half_area();
+        return bbox;
+    }
+};
+
+} // namespace
+
+float refit_bvh4(const TriMesh& mesh, const BuildOptions& options, Bvh4& bvh) {
+    if (bvh.nodes.empty() || bvh.nodes[0].children[0] == 0) return 0.0f;
+
+    int thread_count = options.thread_count > 0 ? options.thread_count : default_thread_count();
+    Refitter refitter = { mesh, options, bvh, thread_count };
+    float cost = 0.0f;
+    BBox bbox = refitter.refit_node(0, 0, cost);
+    float area = bbox.half_area();
+    return area > 0.0f ? cost / area : 0.0f;
+}
@@ -0,0 +1,349 @@
+// Binned SAH builder: at each node, triangles are put into bins along each
+// axis according to their centroid, and the bin boundary with the lowest SAH
+// cost is used as a split. Optionally, spatial splits are also considered
+// (Stich et al., "Spatial Splits in Bounding Volume Hierarchies"): the node is
+// cut by a plane, and the triangles that straddle it are referenced on both
+// sides, with their bounding boxes clipped to each half.
+#include <algorithm>
+#include <utility>
+
+#include "bvh.h"
+
+namespace {
+
+struct Bin {
+    BBox bbox;
+    int count;      // object splits: number of triangles, spatial splits: number of entering triangles
+    int exit;       // spatial splits only: number of exiting triangles
+};
+
+struct Split {
+    int axis;
+    int bin;
+    float cost;
+    BBox left, right;
+};
+
+struct WorkItem {
+    int node;
+    std::vector<PrimRef> refs;
+};
+
+// Number of triangle blocks used to store a leaf
+inline int block_count(int n) { return (n + 3) / 4; }
+
+struct SahBuilder {
+    const TriMesh& mesh;
+    const BuildOptions& options;
+    BuildTree& tree;
+    std::vector<Bin> bins;
+    std::vector<BBox> right_bboxes;
+    int max_ref_count;
+    int ref_count;
+
+    SahBuilder(const TriMesh& mesh, const BuildOptions& options, BuildTree& tree)
+        : mesh(mesh), options(options), tree(tree), bins(options.bin_count), right_bboxes(options.bin_count)
+    {}
+
+    int bin_index(float x, float min, float extent) const {
+        int bin = (x - min) * options.bin_count / extent;
+        return std::min(std::max(bin, 0), options.bin_count - 1);
+    }
+
+    int object_bin(const PrimRef& ref, const BBox& centroid_bbox, int axis) const {
+        float extent = centroid_bbox.max[axis] - centroid_bbox.min[axis];
+        return bin_index(ref.bbox.center(axis), centroid_bbox.min[axis], extent);
+    }
+
+    // Sweeps the bins to find the boundary with the lowest cost. For object
+    // splits, the counts on each side are the same as the bin counts.
+    void sweep(int axis, bool spatial, Split& best) {
+        BBox bbox = BBox::empty();
+        for (int i = options.bin_count - 1; i > 0; i--) {
+            bbox.extend(bins[i].bbox);
+            right_bboxes[i] = bbox;
+        }
+
+        int total = 0;
+        for (auto& bin : bins) total += spatial ? bin.exit : bin.count;
+
+        bbox = BBox::empty();
+        int left_count = 0, right_count = total;
+        for (int i = 0; i < options.bin_count - 1; i++) {
+            bbox.extend(bins[i].bbox);
+            left_count += bins[i].count;
+            right_count -= spatial ? bins[i].exit : bins[i].count;
+            if (left_count == 0 || right_count == 0) continue;
+
+            float cost = bbox.half_area() * block_count(left_count) +
+                         right_bboxes[i + 1].half_area() * block_count(right_count);
+            if (cost < best.cost) best = Split{axis, i + 1, cost, bbox, right_bboxes[i + 1]};
+        }
+    }
+
+    Split find_object_split(const std::vector<PrimRef>& refs, const BBox& centroid_bbox) {
+        Split best = { -1, 0, 1.0e+37f, BBox::empty(), BBox::empty() };
+        for (int axis = 0; axis < 3; axis++) {
+            if (centroid_bbox.max[axis] <= centroid_bbox.min[axis]) continue;
+
+            for (auto& bin : bins) bin = Bin{BBox::empty(), 0, 0};
+            for (auto& ref : refs) {
+                Bin& bin = bins[object_bin(ref, centroid_bbox, axis)];
+                bin.bbox.extend(ref.bbox);
+                bin.count++;
+            }
+            sweep(axis, false, best);
+        }
+        return best;
+    }
+
+    // Splits a reference with a plane, and clips the resulting boxes with the
+    // box of the reference
+    void split_ref(const PrimRef& ref, int axis, float pos, BBox& left, BBox& right) const {
+        left = right = BBox::empty();
+        for (int i = 0; i < 3; i++) {
+            const float* a = mesh.vertex(ref.id, i);
+            const float* b = mesh.vertex(ref.id, (i + 1) % 3);
+            if (a[axis] <= pos) left.extend(a);
+            if (a[axis] >= pos) right.extend(a);
+            if ((a[axis] < pos && b[axis] > pos) || (a[axis] > pos && b[axis] < pos)) {
+                float t = (pos - a[axis]) / (b[axis] - a[axis]);
+                float p[3] = { a[0] + t * (b[0] - a[0]), a[1] + t * (b[1] - a[1]), a[2] + t * (b[2] - a[2]) };
+                p[axis] = pos;
+                left.extend(p);
+                right.extend(p);
+            }
+        }
+
+        left.max[axis] = pos;
+        right.min[axis] = pos;
+        for (int i = 0; i < 3; i++) {
+            left.min[i]  = std::max(left.min[i],  ref.bbox.min[i]);
+            left.max[i]  = std::min(left.max[i],  ref.bbox.max[i]);
+            right.min[i] = std::max(right.min[i], ref.bbox.min[i]);
+            right.max[i] = std::min(right.max[i], ref.bbox.max[i]);
+        }
+    }
+
+    float split_pos(const BBox& bbox, int axis, int bin) const {
+        return bbox.min[axis] + (bbox.max[axis] - bbox.min[axis]) * bin / options.bin_count;
+    }
+
+    Split find_spatial_split(const std::vector<PrimRef>& refs, const BBox& node_bbox) {
+        Split best = { -1, 0, 1.0e+37f, BBox::empty(), BBox::empty() };
+        for (int axis = 0; axis < 3; axis++) {
+            float min = node_bbox.min[axis], extent = node_bbox.max[axis] - min;
+            if (extent <= 0.0f) continue;
+
+            // Each reference is chopped into the bins it overlaps
+            for (auto& bin : bins) bin = Bin{BBox::empty(), 0, 0};
+            for (auto& ref : refs) {
+                int first = bin_index(ref.bbox.min[axis], min, extent);
+                int last  = bin_index(ref.bbox.max[axis], min, extent);
+                bins[first].count++;
+                bins[last].exit++;
+
+                PrimRef cur = ref;
+                for (int i = first; i < last; i++) {
+                    BBox left, right;
+                    split_ref(cur, axis, split_pos(node_bbox, axis, i + 1), left, right);
+                    bins[i].bbox.extend(left);
+                    cur.bbox = right;
+                }
+                bins[last].bbox.extend(cur.bbox);
+            }
+            sweep(axis, true, best);
+        }
+        return best;
+    }
+
+    void partition_object(std::vector<PrimRef>& refs, const BBox& centroid_bbox, const Split& split,
+                          std::vector<PrimRef>& left, std::vector<PrimRef>& right) const {
+        for (auto& ref : refs)
+            (object_bin(ref, centroid_bbox, split.axis) < split.bin ? left : right).push_back(ref);
+    }
+
+    void partition_spatial(std::vector<PrimRef>& refs, const BBox& node_bbox, const Split& split,
+                           std::vector<PrimRef>& left, std::vector<PrimRef>& right) {
+        int axis = split.axis;
+        float min = node_bbox.min[axis], extent = node_bbox.max[axis] - min;
+        float pos = split_pos(node_bbox, axis, split.bin);
+
+        // Straddling references are only split when it is cheaper than moving
+        // them entirely to one side ("reference unsplitting")
+        BBox left_bbox = split.left, right_bbox = split.right;
+        int left_count = 0, right_count = 0;
+        std::vector<const PrimRef*> straddling;
+        for (auto& ref : refs) {
+            int first = bin_index(ref.bbox.min[axis], min, extent);
+            int last  = bin_index(ref.bbox.max[axis], min, extent);
+            if (last < split.bin) {
+                left.push_back(ref);
+            } else if (first >= split.bin) {
+                right.push_back(ref);
+            } else {
+                straddling.push_back(&ref);
+                left_count++;
+                right_count++;
+            }
+        }
+        left_count += left.size();
+        right_count += right.size();
+
+        for (auto ref : straddling) {
+            BBox bbox_l, bbox_r;
+            split_ref(*ref, axis, pos, bbox_l, bbox_r);
+
+            BBox all_left = left_bbox, all_right = right_bbox;
+            all_left.extend(ref->bbox);
+            all_right.extend(ref->bbox);
+            float split_cost = left_bbox.half_area() * block_count(left_count) +
+                               right_bbox.half_area() * block_count(right_count);
+            float left_cost  = all_left.half_area() * block_count(left_count) +
+                               right_bbox.half_area() * block_count(right_count - 1);
+            float right_cost = left_bbox.half_area() * block_count(left_count - 1) +
+                               all_right.half_area() * block_count(right_count);
+
+            // The triangle may not cross the plane inside the box of the reference
+            if (bbox_r.is_empty() || (left_cost < split_cost && left_cost <= right_cost)) {
+                left.push_back(*ref);
+                left_bbox = all_left;
+                right_count--;
+            } else if (bbox_l.is_empty() || right_cost < split_cost) {
+                right.push_back(*ref);
+                right_bbox = all_right;
+                left_count--;
+            } else {
+                left.push_back(PrimRef{bbox_l, ref->id});
+                right.push_back(PrimRef{bbox_r, ref->id});
+                ref_count++;
+            }
+        }
+    }
+
+    // Number of references that would be duplicated by a spatial split
+    int straddling_count(const std::vector<PrimRef>& refs, const BBox& node_bbox, const Split& split) const {
+        float min = node_bbox.min[split.axis], extent = node_bbox.max[split.axis] - min;
+        int count = 0;
+        for (auto& ref : refs) {
+            count += bin_index(ref.bbox.min[split.axis], min, extent) < split.bin &&
+                     bin_index(ref.bbox.max[split.axis], min, extent) >= split.bin;
+        }
+        return count;
+    }
+
+    void make_leaf(WorkItem& item) {
+        BuildNode& node = tree.nodes[item.node];
+        node.first_ref = tree.refs.size();
+        node.ref_count = item.refs.size();
+        for (auto& ref : item.refs) tree.refs.push_back(ref.id);
+    }
+
+    void build(std::vector<PrimRef>&& refs) {
+        tree.nodes.clear();
+        tree.refs.clear();
+        if (refs.empty()) return;
+
+        ref_count = refs.size();
+        max_ref_count = ref_count + static_cast<int>(ref_count * std::max(options.spatial_split_budget, 0.0f));
+
+        std::vector<WorkItem> stack(1);
+        stack[0].refs = std::move(refs);
+        tree.nodes.push_back(BuildNode{BBox::empty(), 0, 0, 0});
+        for (auto& ref : stack[0].refs) tree.nodes[0].bbox.extend(ref.bbox);
+        float root_area = tree.nodes[0].bbox.half_area();
+
+        while (!stack.empty()) {
+            WorkItem item = std::move(stack.back());
+            stack.pop_back();
+
+            int count = item.refs.size();
+            if (count == 1) {
+                make_leaf(item);
+                continue;
+            }
+
+            BBox centroid_bbox = BBox::empty();
+            for (auto& ref : item.refs) {
+                float center[3] = { ref.bbox.center(0), ref.bbox.center(1), ref.bbox.center(2) };
+                centroid_bbox.extend(center);
+            }
+
+            const BBox node_bbox = tree.nodes[item.node].bbox;
+            float area = node_bbox.half_area();
+            Split split = find_object_split(item.refs, centroid_bbox);
+            bool spatial = false;
+
+            if (ref_count < max_ref_count) {
+                BBox overlap = split.left;
+                for (int i = 0; i < 3; i++) {
+                    overlap.min[i] = std::max(overlap.min[i], split.right.min[i]);
+                    overlap.max[i] = std::min(overlap.max[i], split.right.max[i]);
+                }
+                if (split.axis < 0 || overlap.half_area() > options.spatial_split_alpha * root_area) {
+                    Split spatial_split = find_spatial_split(item.refs, node_bbox);
+                    if (spatial_split.cost < split.cost &&
+                        ref_count + straddling_count(item.refs, node_bbox, spatial_split) <= max_ref_count) {
+                        split = spatial_split;
+                        spatial = true;
+                    }
+                }
+            }
+
+            float leaf_cost = options.int_cost * area * block_count(count);
+            float split_cost = options.trav_cost * area + options.int_cost * split.cost;
+            if (count <= options.max_leaf_size && (split.axis < 0 || leaf_cost <= split_cost)) {
+                make_leaf(item);
+                continue;
+            }
+
+            WorkItem left, right;
+            if (split.axis >= 0) {
+                if (spatial)
+                    partition_spatial(item.refs, node_bbox, split, left.refs, right.refs);
+                else
+                    partition_object(item.refs, centroid_bbox, split, left.refs, right.refs);
+            }
+            if (left.refs.empty() || right.refs.empty()) {
+                // All centroids are at the same position: split in the middle,
+                // and give back the duplicates of a spatial partition, if any
+                if (split.axis >= 0)
+                    ref_count -= static_cast<int>(left.refs.size() + right.refs.size()) - count;
+                left.refs.clear();
+                right.refs.clear();
+                left.refs.assign(item.refs.begin(), item.refs.begin() + count / 2);
+                right.refs.assign(item.refs.begin() + count / 2, item.refs.end());
+            }
+            item.refs = std::vector<PrimRef>();
+
+            int child = tree.nodes.size();
+            left.node = child + 0;
+            right.node = child + 1;
+            for (auto child_item : { &left, &right }) {
+                BBox bbox = BBox::empty();
+                for (auto& ref : child_item->refs) bbox.extend(ref.bbox);
+                tree.nodes.push_back(BuildNode{bbox, 0, 0, 0});
+            }
+            tree.nodes[item.node].child = child;
+
+            stack.push_back(std::move(left));
+            stack.push_back(std::move(right));
+        }
+    }
+};
+
+} // namespace
+
+void build_sah(const TriMesh& mesh, const BuildOptions& options, BuildTree& tree) {
+    std::vector<PrimRef> refs;
+    make_prim_refs(mesh, refs);
+    SahBuilder(mesh, options, tree).build(std::move(refs));
+}
+
+void build_sah(const std::vector<PrimRef>& refs, const BuildOptions& options, BuildTree& tree) {
+    // Spatial splits need the triangles, which are not known here
+    static const TriMesh no_mesh;
+    BuildOptions object_options = options;
+    object_options.spatial_split_budget = 0.0f;
+    SahBuilder(no_mesh, object_options, tree).build(std::vector<PrimRef>(refs));
+}
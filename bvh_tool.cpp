@@ -0,0 +1,196 @@
+// Builds the BVH of a scene and writes the buffers passed to traverse_accel:
+//   bvh_tool [options] scene.obj|scene.ply output
+// produces output.nodes, output.tris, and output.ids (mesh triangle of each hit id),
+// or with --cache, the single file output in the format of bvh_cache.h
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "bvh.h"
+#include "bvh_cache.h"
+#include "mesh.h"
+
+static void usage(const char* name) {
+    std::fprintf(stderr,
+        "usage: %s [options] scene.obj|scene.ply output\n"
+        "options:\n"
+        "  --bins n         number of bins per axis (default 16)\n"
+        "  --leaf-size n    maximum number of triangles per leaf (default 16)\n"
+        "  --trav-cost c    cost of traversing a node (default 1)\n"
+        "  --int-cost c     cost of intersecting a block of 4 triangles (default 6)\n"
+        "  --builder b      sah or lbvh (default sah)\n"
+        "  --spatial b      enables spatial splits in the SAH builder, with at most\n"
+        "                   b times the number of triangles as extra references\n"
+        "  --spatial-alpha a  minimum overlap of the children, relative to the root,\n"
+        "                   for spatial splits to be tried (default 1e-5)\n"
+        "  --morton-bits n  number of bits of the Morton codes, 30 or 63 (default 30)\n"
+        "  --treelets n     number of treelet optimization passes (default 0)\n"
+        "  --threads n      number of threads of the parallel builders (default: all cores)\n"
+        "  --gpu            write the layout of mapping_gpu.impala instead of mapping_cpu.impala\n"
+        "  --quantize       write the nodes in the layout of node_cpu_quantized.impala\n"
+        "  --indexed        write the leaves in the layout of tri_cpu_indexed.impala\n"
+        "  --woop           write the Woop transforms of the triangles instead of their\n"
+        "                   vertices (for the traversal compiled with woop_triangles)\n"
+        "  --cache          write a cache file that BvhCache maps directly (bvh_cache.h)\n",
+        name);
+}
+
+template <typename T>
+static bool write_buffer(const std::string& file_name, const std::vector<T>& data) {
+    FILE* fp = std::fopen(file_name.c_str(), "wb");
+    if (!fp) return false;
+    bool ok = std::fwrite(data.data(), sizeof(T), data.size(), fp) == data.size();
+    return std::fclose(fp) == 0 && ok;
+}
+
+template <typename Bvh>
+static bool write_bvh(const std::string& output, const Bvh& bvh) {
+    return write_buffer(output + ".nodes", bvh.nodes) &&
+           write_buffer(output + ".tris", bvh.tris) &&
+           write_buffer(output + ".ids", bvh.tri_ids);
+}
+
+int main(int argc, char** argv) {
+    BuildOptions options;
+    std::string builder = "sah";
+    bool gpu = false;
+    bool quantize = false;
+    bool indexed = false;
+    bool woop = false;
+    bool cache = false;
+    const char* files[2];
+    int file_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_arg = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--bins") && has_arg) {
+            options.bin_count = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--leaf-size") && has_arg) {
+            options.max_leaf_size = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--trav-cost") && has_arg) {
+            options.trav_cost = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--int-cost") && has_arg) {
+            options.int_cost = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--builder") && has_arg) {
+            builder = argv[++i];
+        } else if (!std::strcmp(argv[i], "--spatial") && has_arg) {
+            options.spatial_split_budget = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--spatial-alpha") && has_arg) {
+            options.spatial_split_alpha = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--morton-bits") && has_arg) {
+            options.morton_bits = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--treelets") && has_arg) {
+            options.treelet_passes = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--threads") && has_arg) {
+            options.thread_count = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--gpu")) {
+            gpu = true;
+        } else if (!std::strcmp(argv[i], "--quantize")) {
+            quantize = true;
+        } else if (!std::strcmp(argv[i], "--indexed")) {
+            indexed = true;
+        } else if (!std::strcmp(argv[i], "--woop")) {
+            woop = true;
+        } else if (!std::strcmp(argv[i], "--cache")) {
+            cache = true;
+        } else if (argv[i][0] != '-' && file_count < 2) {
+            files[file_count++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (file_count != 2 || (gpu && (quantize || indexed)) || (indexed && woop) || options.bin_count < 2 || options.max_leaf_size < 1 ||
+        (builder != "sah" && builder != "lbvh") ||
+        (options.morton_bits != 30 && options.morton_bits != 63)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    TriMesh mesh;
+    if (!load_scene(files[0], mesh)) {
+        std::fprintf(stderr, "cannot load %s\n", files[0]);
+        return 1;
+    }
+    std::printf("%d triangles\n", mesh.tri_count());
+
+    auto start = std::chrono::high_resolution_clock::now();
+    BuildTree tree;
+    Bvh4 bvh4;
+    Bvh2 bvh2;
+    if (builder == "lbvh") {
+        build_lbvh(mesh, options, tree);
+        optimize_treelets(options, tree);
+    } else {
+        build_sah(mesh, options, tree);
+    }
+    if (gpu)
+        emit_bvh2(mesh, tree, bvh2);
+    else if (woop)
+        emit_bvh4_woop(mesh, tree, bvh4);
+    else
+        emit_bvh4(mesh, tree, bvh4);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    BuildStats stats;
+    stats.build_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    if (gpu)
+        compute_stats(bvh2, options, stats);
+    else
+        compute_stats(bvh4, options, stats);
+    print_stats(stdout, stats);
+
+    // The statistics are computed on the precomputed leaves, which have the same tree
+    if (gpu && woop) {
+        Bvh2 wbvh;
+        emit_bvh2_woop(mesh, tree, wbvh);
+        bvh2.nodes.swap(wbvh.nodes);
+        bvh2.tris.swap(wbvh.tris);
+        bvh2.tri_ids.swap(wbvh.tri_ids);
+    }
+    if (indexed) {
+        Bvh4i ibvh;
+        emit_bvh4_indexed(mesh, tree, ibvh);
+        std::printf("leaf data: %.1f MB (indexed) instead of %.1f MB\n",
+            ibvh.tris.size() * sizeof(Vec4) * 1.0e-6, bvh4.tris.size() * sizeof(Vec4) * 1.0e-6);
+        bvh4.nodes.swap(ibvh.nodes);
+        bvh4.tris.swap(ibvh.tris);
+        bvh4.tri_ids.swap(ibvh.tri_ids);
+    }
+
+    std::string output = files[1];
+    BvhCacheKey key;
+    key.mesh_hash = cache ? hash_mesh(mesh) : 0;
+    key.layout = (gpu ? bvh_layout_gpu : 0) | (quantize ? bvh_layout_quantized : 0) |
+                 (indexed ? bvh_layout_indexed : 0) | (woop ? bvh_layout_woop : 0);
+    key.builder = builder == "lbvh" ? bvh_builder_lbvh : bvh_builder_sah;
+    key.options = options;
+    bool ok;
+    if (gpu) {
+        ok = cache ? write_bvh_cache(files[1], key, mesh, bvh2) : write_bvh(output, bvh2);
+    } else if (quantize) {
+        std::vector<Node4q> qnodes;
+        quantize_nodes(bvh4.nodes, qnodes);
+        std::printf("node size: %d bytes (quantized) instead of %d bytes\n",
+            static_cast<int>(qnodes.size() * sizeof(Node4q)), static_cast<int>(bvh4.nodes.size() * sizeof(Node4)));
+        if (cache) {
+            ok = write_bvh_cache(files[1], key, mesh, qnodes.data(), qnodes.size() * sizeof(Node4q),
+                                 bvh4.tris.data(), bvh4.tris.size() * sizeof(Vec4), bvh4.tri_ids.data(), bvh4.tri_ids.size());
+        } else {
+            ok = write_buffer(output + ".nodes", qnodes) &&
+                 write_buffer(output + ".tris", bvh4.tris) &&
+                 write_buffer(output + ".ids", bvh4.tri_ids);
+        }
+    } else {
+        ok = cache ? write_bvh_cache(files[1], key, mesh, bvh4) : write_bvh(output, bvh4);
+    }
+    if (!ok) {
+        std::fprintf(stderr, "cannot write %s\n", files[1]);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Renders the traversal cost of the primary rays of a scene as a false color
+// image, to find the parts of the scene where the BVH is poor or the leaves are
+// large:
+//   heatmap [options] scene.obj|scene.ply output.ppm
+// Each pixel shows the cost of its ray, from blue (cheap) to red (at or above
+// the maximum), as computed by traverse_accel_cost.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "mesh.h"
+#include "rays.h"
+#include "traverse.h"
+
+static void usage(const char* name) {
+    std::fprintf(stderr,
+        "usage: %s [options] scene.obj|scene.ply output.ppm\n"
+        "options:\n"
+        "  --width n        width of the image (default 1024)\n"
+        "  --height n       height of the image (default 1024)\n"
+        "  --metric m       nodes, leaves, tris, or cost: nodes plus the SAH weighted\n"
+        "                   triangle tests (default cost)\n"
+        "  --max c          cost mapped to red (default: the 99th percentile)\n"
+        "  --builder b      sah or lbvh (default sah)\n"
+        "  --leaf-size n    maximum number of triangles per leaf (default 16)\n"
+        "  --spatial b      spatial split budget of the SAH builder (default 0)\n"
+        "  --threads n      number of threads of the traversal (default: all cores)\n",
+        name);
+}
+
+// Blue, cyan, green, yellow, red
+static void false_color(float x, unsigned char* rgb) {
+    static const float ramp[5][3] = { {0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0} };
+    x = std::min(std::max(x, 0.0f), 1.0f) * 4.0f;
+    int i = std::min(static_cast<int>(x), 3);
+    float f = x - i;
+    for (int k = 0; k < 3; k++) {
+        rgb[k] = static_cast<unsigned char>(255.0f * (ramp[i][k] * (1.0f - f) + ramp[i + 1][k] * f) + 0.5f);
+    }
+}
+
+static bool write_ppm(const char* file_name, int width, int height, const std::vector<unsigned char>& rgb) {
+    FILE* fp = std::fopen(file_name, "wb");
+    if (!fp) return false;
+    std::fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    bool ok = std::fwrite(rgb.data(), 1, rgb.size(), fp) == rgb.size();
+    return std::fclose(fp) == 0 && ok;
+}
+
+int main(int argc, char** argv) {
+    BuildOptions options;
+    std::string builder = "sah";
+    std::string metric = "cost";
+    int width = 1024, height = 1024;
+    int threads = 0;
+    float max_cost = 0.0f;
+    const char* files[2];
+    int file_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_arg = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--width") && has_arg) {
+            width = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--height") && has_arg) {
+            height = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--metric") && has_arg) {
+            metric = argv[++i];
+        } else if (!std::strcmp(argv[i], "--max") && has_arg) {
+            max_cost = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--builder") && has_arg) {
+            builder = argv[++i];
+        } else if (!std::strcmp(argv[i], "--leaf-size") && has_arg) {
+            options.max_leaf_size = std::atoi(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--spatial") && has_arg) {
+            options.spatial_split_budget = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--threads") && has_arg) {
+            threads = std::atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && file_count < 2) {
+            files[file_count++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (file_count != 2 || width < 1 || height < 1 ||
+        (builder != "sah" && builder != "lbvh") ||
+        (metric != "nodes" && metric != "leaves" && metric != "tris" && metric != "cost")) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    TriMesh mesh;
+    if (!load_scene(files[0], mesh)) {
+        std::fprintf(stderr, "cannot load %s\n", files[0]);
+        return 1;
+    }
+
+    BuildTree tree;
+    Bvh4 bvh;
+    if (builder == "lbvh") {
+        build_lbvh(mesh, options, tree);
+        optimize_treelets(options, tree);
+    } else {
+        build_sah(mesh, options, tree);
+    }
+    emit_bvh4(mesh, tree, bvh);
+
+    traverse_set_thread_count(threads);
+
+    std::vector<Ray> rays;
+    generate_primary_rays(mesh, width, height, rays);
+    int ray_count = rays.size();
+    std::vector<Hit> hits(ray_count);
+    std::vector<TraverseCost> costs(ray_count);
+    traverse_accel_cost(bvh.nodes.data(), rays.data(), bvh.tris.data(), hits.data(), costs.data(), ray_count);
+
+    // Triangle tests are weighted like in the SAH: they count triangles in every
+    // mapping, and int_cost is the cost of a block of 4 triangles
+    std::vector<float> values(ray_count);
+    double sums[3] = { 0.0, 0.0, 0.0 };
+    for (int i = 0; i < ray_count; i++) {
+        const TraverseCost& cost = costs[i];
+        sums[0] += cost.nodes;
+        sums[1] += cost.leaves;
+        sums[2] += cost.tri_tests;
+        if (metric == "nodes") values[i] = cost.nodes;
+        else if (metric == "leaves") values[i] = cost.leaves;
+        else if (metric == "tris") values[i] = cost.tri_tests;
+        else values[i] = options.trav_cost * cost.nodes + options.int_cost / 4 * cost.tri_tests;
+    }
+    std::printf("per ray: %.2f nodes, %.2f leaves, %.2f triangle tests\n",
+                sums[0] / ray_count, sums[1] / ray_count, sums[2] / ray_count);
+
+    // A percentile keeps a few expensive rays from darkening the whole image
+    if (max_cost <= 0.0f) {
+        std::vector<float> sorted(values);
+        auto p99 = sorted.begin() + (ray_count - 1) * 99 / 100;
+        std::nth_element(sorted.begin(), p99, sorted.end());
+        max_cost = std::max(*p99, 1.0f);
+    }
+    std::printf("%s mapped to red: %.2f\n", metric.c_str(), max_cost);
+
+    std::vector<unsigned char> rgb(3 * ray_count);
+    for (int i = 0; i < ray_count; i++) false_color(values[i] / max_cost, &rgb[3 * i]);
+
+    if (!write_ppm(files[1], width, height, rgb)) {
+        std::fprintf(stderr, "cannot write %s\n", files[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "mesh.h"
+
+// Converts an OBJ index (1-based, or negative when relative to the end) to a 0-based index
+static int obj_index(const std::string& token, int vertex_count) {
+    int index = std::atoi(token.c_str());
+    return index < 0 ? vertex_count + index : index - 1;
+}
+
+bool load_obj(const char* file_name, TriMesh& mesh) {
+    std::ifstream is(file_name);
+    if (!is) return false;
+
+    mesh.vertices.clear();
+    mesh.indices.clear();
+
+    std::string line;
+    std::vector<int> face;
+    while (std::getline(is, line)) {
+        std::istringstream tokens(line);
+        std::string type;
+        tokens >> type;
+
+        if (type == "v") {
+            float x = 0, y = 0, z = 0;
+            tokens >> x >> y >> z;
+            mesh.vertices.push_back(x);
+            mesh.vertices.push_back(y);
+            mesh.vertices.push_back(z);
+        } else if (type == "f") {
+            int vertex_count = mesh.vertices.size() / 3;
+            face.clear();
+            for (std::string token; tokens >> token; ) {
+                // Only keep the position index of v/vt/vn
+                int index = obj_index(token.substr(0, token.find('/')), vertex_count);
+                if (index < 0 || index >= vertex_count) return false;
+                face.push_back(index);
+            }
+
+            for (size_t i = 2; i < face.size(); i++) {
+                mesh.indices.push_back(face[0]);
+                mesh.indices.push_back(face[i - 1]);
+                mesh.indices.push_back(face[i]);
+            }
+        }
+    }
+
+    return true;
+}
+
+namespace {
+
+struct PlyProperty {
+    std::string name;
+    std::string type;       // type of the values
+    std::string count_type; // type of the number of values (lists only)
+};
+
+struct PlyElement {
+    std::string name;
+    int count;
+    std::vector<PlyProperty> properties;
+};
+
+int ply_type_size(const std::string& type) {
+    if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") return 1;
+    if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") return 2;
+    if (type == "int" || type == "uint" || type == "float" || type == "int32" || type == "uint32" || type == "float32") return 4;
+    if (type == "double" || type == "float64") return 8;
+    return 0;
+}
+
+// Reads one value from an ASCII or a little endian binary file
+bool read_ply_value(std::istream& is, bool binary, const std::string& type, double& value) {
+    if (!binary) return static_cast<bool>(is >> value);
+
+    char data[8];
+    int size = ply_type_size(type);
+    if (!is.read(data, size)) return false;
+    if (type == "char" || type == "int8")          { int8_t   x; std::memcpy(&x, data, 1); value = x; }
+    else if (type == "uchar" || type == "uint8")   { uint8_t  x; std::memcpy(&x, data, 1); value = x; }
+    else if (type == "short" || type == "int16")   { int16_t  x; std::memcpy(&x, data, 2); value = x; }
+    else if (type == "ushort" || type == "uint16") { uint16_t x; std::memcpy(&x, data, 2); value = x; }
+    else if (type == "int" || type == "int32")     { int32_t  x; std::memcpy(&x, data, 4); value = x; }
+    else if (type == "uint" || type == "uint32")   { uint32_t x; std::memcpy(&x, data, 4); value = x; }
+    else if (type == "float" || type == "float32") { float    x; std::memcpy(&x, data, 4); value = x; }
+    else                                           { double   x; std::memcpy(&x, data, 8); value = x; }
+    return true;
+}
+
+} // namespace
+
+bool load_ply(const char* file_name, TriMesh& mesh) {
+    std::ifstream is(file_name, std::ios::binary);
+    if (!is) return false;
+
+    mesh.vertices.clear();
+    mesh.indices.clear();
+
+    // Header
+    std::string line;
+    if (!std::getline(is, line) || line.compare(0, 3, "ply") != 0) return false;
+    bool binary = false;
+    std::vector<PlyElement> elements;
+    while (std::getline(is, line)) {
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+        if (keyword == "format") {
+            std::string format;
+            tokens >> format;
+            if (format == "binary_little_endian") binary = true;
+            else if (format != "ascii") return false;
+        } else if (keyword == "element") {
+            PlyElement element;
+            tokens >> element.name >> element.count;
+            elements.push_back(element);
+        } else if (keyword == "property" && !elements.empty()) {
+            PlyProperty property;
+            tokens >> property.type;
+            if (property.type == "list") tokens >> property.count_type >> property.type;
+            tokens >> property.name;
+            if (!ply_type_size(property.type) || (!property.count_type.empty() && !ply_type_size(property.count_type)))
+                return false;
+            elements.back().properties.push_back(property);
+        } else if (keyword == "end_header") {
+            break;
+        }
+    }
+
+    // Data: only the vertex positions and the faces are kept
+    std::vector<int> face;
+    for (auto& element : elements) {
+        for (int i = 0; i < element.count; i++) {
+            float position[3] = { 0.0f, 0.0f, 0.0f };
+            for (auto& property : element.properties) {
+                double value;
+                if (property.count_type.empty()) {
+                    if (!read_ply_value(is, binary, property.type, value)) return false;
+                    if (property.name == "x") position[0] = value;
+                    if (property.name == "y") position[1] = value;
+                    if (property.name == "z") position[2] = value;
+                    continue;
+                }
+
+                double count;
+                if (!read_ply_value(is, binary, property.count_type, count)) return false;
+                face.clear();
+                for (int j = 0; j < static_cast<int>(count); j++) {
+                    if (!read_ply_value(is, binary, property.type, value)) return false;
+                    face.push_back(static_cast<int>(value));
+                }
+                if (element.name == "face" && (property.name == "vertex_indices" || property.name == "vertex_index")) {
+                    for (size_t j = 2; j < face.size(); j++) {
+                        mesh.indices.push_back(face[0]);
+                        mesh.indices.push_back(face[j - 1]);
+                        mesh.indices.push_back(face[j]);
+                    }
+                }
+            }
+            if (element.name == "vertex") mesh.vertices.insert(mesh.vertices.end(), position, position + 3);
+        }
+    }
+
+    int vertex_count = mesh.vertices.size() / 3;
+    for (int index : mesh.indices) {
+        if (index < 0 || index >= vertex_count) return false;
+    }
+    return true;
+}
+
+bool load_scene(const char* file_name, TriMesh& mesh) {
+    size_t len = std::strlen(file_name);
+    if (len >= 4 && !std::strcmp(file_name + len - 4, ".ply")) return load_ply(file_name, mesh);
+    return load_obj(file_name, mesh);
+}
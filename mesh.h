@@ -0,0 +1,16 @@
+// Scene loading for the BVH tools
+#ifndef MESH_H
+#define MESH_H
+
+#include "bvh.h"
+
+// Loads the triangles of a Wavefront OBJ file (polygons are triangulated)
+bool load_obj(const char* file_name, TriMesh& mesh);
+
+// Loads the faces of a Stanford PLY file, in ASCII or little endian binary format
+bool load_ply(const char* file_name, TriMesh& mesh);
+
+// Loads an OBJ or a PLY file, depending on its extension
+bool load_scene(const char* file_name, TriMesh& mesh);
+
+#endif // MESH_H
@@ -0,0 +1,99 @@
+// Morton codes and parallel radix sort, shared by the linear BVH builder and
+// the ray sorter
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "bvh.h"
+#include "parallel.h"
+
+// Inserts two zero bits between each of the 10 lowest bits of x
+inline uint32_t expand_bits(uint32_t x) {
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x <<  8)) & 0x0300F00F;
+    x = (x | (x <<  4)) & 0x030C30C3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+// Inserts two zero bits between each of the 21 lowest bits of x
+inline uint64_t expand_bits(uint64_t x) {
+    x = (x | (x << 32)) & 0x001F00000000FFFFull;
+    x = (x | (x << 16)) & 0x001F0000FF0000FFull;
+    x = (x | (x <<  8)) & 0x100F00F00F00F00Full;
+    x = (x | (x <<  4)) & 0x10C30C30C30C30C3ull;
+    x = (x | (x <<  2)) & 0x1249249249249249ull;
+    return x;
+}
+
+// Morton code of a point in a bounding box, with 10 bits per axis for 32-bit
+// codes and 21 bits per axis for 64-bit codes
+template <typename Key>
+Key morton_code(const float* p, const BBox& bbox) {
+    const int bits = sizeof(Key) == 4 ? 10 : 21;
+    const float scale = static_cast<float>((1 << bits) - 1);
+    Key code = 0;
+    for (int i = 0; i < 3; i++) {
+        float extent = bbox.max[i] - bbox.min[i];
+        float x = extent > 0.0f ? (p[i] - bbox.min[i]) / extent : 0.0f;
+        Key q = static_cast<Key>(std::min(std::max(x * scale, 0.0f), scale));
+        code |= expand_bits(q) << (2 - i);
+    }
+    return code;
+}
+
+// Least-significant digit radix sort of (key, value) pairs, with per-thread histograms
+template <typename Key>
+void radix_sort(int thread_count, std::vector<Key>& keys, std::vector<int>& values) {
+    const int digit_bits = 8;
+    const int bucket_count = 1 << digit_bits;
+    const int pass_count = (sizeof(Key) * 8 + digit_bits - 1) / digit_bits;
+    const int n = keys.size();
+
+    std::vector<Key> tmp_keys(n);
+    std::vector<int> tmp_values(n);
+    std::vector<int> histograms(thread_count * bucket_count);
+
+    // Skip the passes where all the keys share the same digit
+    Key diff = 0;
+    for (int i = 1; i < n; i++) diff |= keys[i] ^ keys[0];
+
+    for (int pass = 0; pass < pass_count; pass++) {
+        int shift = pass * digit_bits;
+        if (((diff >> shift) & (bucket_count - 1)) == 0) continue;
+
+        std::fill(histograms.begin(), histograms.end(), 0);
+        parallel_ranges(thread_count, 0, n, [&] (int thread, int begin, int end) {
+            int* histogram = &histograms[thread * bucket_count];
+            for (int i = begin; i < end; i++) histogram[(keys[i] >> shift) & (bucket_count - 1)]++;
+        });
+
+        // Turn the histograms into offsets, ordered by bucket then by thread
+        // so that the sort is stable
+        int offset = 0;
+        for (int bucket = 0; bucket < bucket_count; bucket++) {
+            for (int thread = 0; thread < thread_count; thread++) {
+                int count = histograms[thread * bucket_count + bucket];
+                histograms[thread * bucket_count + bucket] = offset;
+                offset += count;
+            }
+        }
+
+        parallel_ranges(thread_count, 0, n, [&] (int thread, int begin, int end) {
+            int* offsets = &histograms[thread * bucket_count];
+            for (int i = begin; i < end; i++) {
+                int j = offsets[(keys[i] >> shift) & (bucket_count - 1)]++;
+                tmp_keys[j] = keys[i];
+                tmp_values[j] = values[i];
+            }
+        });
+
+        std::swap(keys, tmp_keys);
+        std::swap(values, tmp_values);
+    }
+}
+
+#endif // MORTON_H
@@ -0,0 +1,63 @@
+// Minimal threading helpers for the BVH tools
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+inline int default_thread_count() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Splits [begin, end) into one contiguous range per thread, and calls
+// body(thread_index, range_begin, range_end) on each of them
+template <typename F>
+void parallel_ranges(int thread_count, int begin, int end, F body) {
+    int count = end - begin;
+    thread_count = std::max(1, std::min(thread_count, count));
+    if (thread_count == 1) {
+        body(0, begin, end);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_count; i++) {
+        int range_begin = begin + static_cast<long long>(count) * i / thread_count;
+        int range_end   = begin + static_cast<long long>(count) * (i + 1) / thread_count;
+        threads.emplace_back(body, i, range_begin, range_end);
+    }
+    for (auto& thread : threads) thread.join();
+}
+
+// Calls body(i) for every i in [begin, end)
+template <typename F>
+void parallel_for(int thread_count, int begin, int end, F body) {
+    parallel_ranges(thread_count, begin, end, [&] (int, int range_begin, int range_end) {
+        for (int i = range_begin; i < range_end; i++) body(i);
+    });
+}
+
+// Runs both functions, in parallel if requested
+template <typename F, typename G>
+void parallel_invoke(bool parallel, F f, G g) {
+    if (!parallel) {
+        f();
+        g();
+        return;
+    }
+
+    std::thread thread(f);
+    g();
+    thread.join();
+}
+
+// Depth of the binary recursion down to which tasks are run in parallel
+inline int spawn_depth(int thread_count) {
+    if (thread_count <= 1) return 0;
+    int depth = 0;
+    while ((1 << depth) < thread_count) depth++;
+    return depth + 2;
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,108 @@
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <cpuid.h>
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Raw event of the retired vector instructions, or 0 when unknown
+static uint64_t vector_ops_event() {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) return 0;
+    char vendor[13];
+    std::memcpy(vendor + 0, &ebx, 4);
+    std::memcpy(vendor + 4, &edx, 4);
+    std::memcpy(vendor + 8, &ecx, 4);
+    vendor[12] = 0;
+
+    // FP_ARITH_INST_RETIRED (Skylake and later), 128, 256 and 512-bit packed single
+    if (!std::strcmp(vendor, "GenuineIntel")) return 0xC7 | (0xA8 << 8);
+    // Retired SSE/AVX operations (Zen), all types
+    if (!std::strcmp(vendor, "AuthenticAMD")) return 0x03 | (0xFF << 8);
+    return 0;
+}
+
+static int open_event(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+bool PerfCounters::open() {
+    auto cache_miss = [] (uint64_t cache) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    };
+    fds[perf_cycles]        = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds[perf_instructions]  = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[perf_l1d_misses]    = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D));
+    fds[perf_llc_misses]    = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL));
+    fds[perf_branch_misses] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    uint64_t vector_ops = vector_ops_event();
+    fds[perf_vector_ops]    = vector_ops ? open_event(PERF_TYPE_RAW, vector_ops) : -1;
+    return any_available();
+}
+
+void PerfCounters::close() {
+    for (int& fd : fds) {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+}
+
+// Enabling or resetting the parent counter also applies to the inherited ones
+void PerfCounters::start() {
+    for (int fd : fds) {
+        if (fd < 0) continue;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void PerfCounters::stop() {
+    for (int fd : fds) {
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+}
+
+double PerfCounters::read(PerfEvent event) const {
+    // Value, time enabled and time running: the counter only ran for part of
+    // the time when there are more events than hardware counters
+    uint64_t values[3];
+    if (fds[event] < 0 || ::read(fds[event], values, sizeof(values)) != sizeof(values)) return 0.0;
+    if (values[2] == 0) return 0.0;
+    return static_cast<double>(values[0]) * values[1] / values[2];
+}
+#else
+bool PerfCounters::open() { return false; }
+
+void PerfCounters::close() {}
+void PerfCounters::start() {}
+void PerfCounters::stop() {}
+double PerfCounters::read(PerfEvent) const { return 0.0; }
+#endif
+
+bool PerfCounters::any_available() const {
+    for (int fd : fds) {
+        if (fd >= 0) return true;
+    }
+    return false;
+}
+
+const char* PerfCounters::name(PerfEvent event) {
+    static const char* names[perf_event_count] = {
+        "cycles", "instructions", "L1D misses", "LLC misses", "branch misses", "vector ops"
+    };
+    return names[event];
+}
@@ -0,0 +1,42 @@
+// Hardware performance counters of the benchmarks, read with perf_event_open.
+// Only user space events of the calling process are counted, which works
+// without root when kernel.perf_event_paranoid is at most 2. Counters that
+// cannot be opened (other operating systems, virtual machines without a PMU,
+// or a stricter paranoid level) are reported as unavailable.
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+enum PerfEvent {
+    perf_cycles,
+    perf_instructions,
+    perf_l1d_misses,
+    perf_llc_misses,
+    perf_branch_misses,
+    perf_vector_ops,    // retired packed single precision instructions (model specific)
+    perf_event_count
+};
+
+struct PerfCounters {
+    int fds[perf_event_count];
+
+    PerfCounters() { for (int& fd : fds) fd = -1; }
+
+    // The counters follow the threads created after open() (inherit), so open()
+    // must be called before the traversal starts its worker threads
+    bool open();
+    void close();
+
+    bool available(PerfEvent event) const { return fds[event] >= 0; }
+    bool any_available() const;
+
+    // Resets and starts all the counters, then stops them
+    void start();
+    void stop();
+
+    // Value since the last start(), scaled when the counter was multiplexed
+    double read(PerfEvent event) const;
+
+    static const char* name(PerfEvent event);
+};
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,37 @@
+// Reordering of ray batches into coherent packets for the CPU mapping
+#ifndef RAY_SORT_H
+#define RAY_SORT_H
+
+#include <cstdint>
+#include <vector>
+
+#include "rays.h"
+
+// Sorts rays by direction octant, then along a Morton curve that interleaves
+// the position of the origin in the bounding box of the batch with the
+// direction, so that consecutive rays (the packets of iterate_rays) start close
+// to each other and go the same way. The sorted buffer is padded to a multiple
+// of 32 rays with empty rays.
+struct RaySorter {
+    int thread_count;
+    std::vector<uint32_t> keys;
+    std::vector<int> order;         // index in the input of each sorted ray
+    std::vector<Ray> sorted_rays;
+    std::vector<Hit> sorted_hits;
+
+    explicit RaySorter(int thread_count = 0);
+
+    void sort(const Ray* rays, int ray_count);
+    void scatter(Hit* hits) const;
+
+    // Traces the sorted rays with traverse(rays, hits, padded_count), and
+    // writes the hits back in the order of the input
+    template <typename F>
+    void trace(const Ray* rays, Hit* hits, int ray_count, F traverse) {
+        sort(rays, ray_count);
+        traverse(sorted_rays.data(), sorted_hits.data(), static_cast<int>(sorted_rays.size()));
+        scatter(hits);
+    }
+};
+
+#endif // RAY_SORT_H
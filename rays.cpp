@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "rays.h"
+
+namespace {
+
+const float pi = 3.14159265f;
+
+BBox mesh_bbox(const TriMesh& mesh) {
+    BBox bbox = BBox::empty();
+    for (size_t i = 0; i < mesh.vertices.size(); i += 3) bbox.extend(&mesh.vertices[i]);
+    return bbox;
+}
+
+float diagonal(const BBox& bbox) {
+    float dx = bbox.max[0] - bbox.min[0], dy = bbox.max[1] - bbox.min[1], dz = bbox.max[2] - bbox.min[2];
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+void normalize(float* v) {
+    float len = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if (len > 0.0f) for (int i = 0; i < 3; i++) v[i] /= len;
+}
+
+void cross(const float* a, const float* b, float* c) {
+    c[0] = a[1] * b[2] - a[2] * b[1];
+    c[1] = a[2] * b[0] - a[0] * b[2];
+    c[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+Ray make_ray(const float* org, const float* dir, float tmin, float tmax) {
+    return Ray{{org[0], org[1], org[2], tmin}, {dir[0], dir[1], dir[2], tmax}};
+}
+
+} // namespace
+
+void generate_primary_rays(const TriMesh& mesh, int width, int height, std::vector<Ray>& rays) {
+    BBox bbox = mesh_bbox(mesh);
+    float diag = diagonal(bbox);
+    float center[3] = { bbox.center(0), bbox.center(1), bbox.center(2) };
+    float eye[3] = { center[0], center[1] + 0.2f * diag, center[2] + 1.2f * diag };
+
+    float forward[3] = { center[0] - eye[0], center[1] - eye[1], center[2] - eye[2] };
+    float up[3] = { 0.0f, 1.0f, 0.0f };
+    float right[3];
+    normalize(forward);
+    cross(forward, up, right);
+    normalize(right);
+    cross(right, forward, up);
+
+    float scale = std::tan(pi / 6.0f);
+    float aspect = static_cast<float>(width) / height;
+    rays.resize(width * height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float sx = (2.0f * (x + 0.5f) / width - 1.0f) * scale * aspect;
+            float sy = (1.0f - 2.0f * (y + 0.5f) / height) * scale;
+            float dir[3];
+            for (int i = 0; i < 3; i++) dir[i] = forward[i] + sx * right[i] + sy * up[i];
+            rays[y * width + x] = make_ray(eye, dir, 0.0f, 1.0e+30f);
+        }
+    }
+}
+
+void generate_secondary_rays(const TriMesh& mesh, const std::vector<int>& tri_ids,
+                             const std::vector<Ray>& rays, const std::vector<Hit>& hits,
+                             SecondaryRays type, float radius, unsigned seed, std::vector<Ray>& secondary) {
+    BBox bbox = mesh_bbox(mesh);
+    float diag = diagonal(bbox);
+    float offset = 1.0e-4f * diag;
+    float light[3] = { bbox.center(0), bbox.max[1] + 0.5f * diag, bbox.center(2) };
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    secondary.clear();
+    for (size_t i = 0; i < hits.size(); i++) {
+        const Hit& hit = hits[i];
+        if (hit.tri_id < 0 || tri_ids[hit.tri_id] < 0) continue;
+
+        const Ray& ray = rays[i];
+        float d[3] = { ray.dir.x, ray.dir.y, ray.dir.z };
+        float p[3] = { ray.org.x + hit.tmax * d[0], ray.org.y + hit.tmax * d[1], ray.org.z + hit.tmax * d[2] };
+
+        // Geometric normal, facing the incoming ray
+        int tri = tri_ids[hit.tri_id];
+        const float* v0 = mesh.vertex(tri, 0);
+        const float* v1 = mesh.vertex(tri, 1);
+        const float* v2 = mesh.vertex(tri, 2);
+        float e1[3] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
+        float e2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
+        float n[3];
+        cross(e1, e2, n);
+        normalize(n);
+        if (n[0] * d[0] + n[1] * d[1] + n[2] * d[2] > 0.0f) for (int k = 0; k < 3; k++) n[k] = -n[k];
+
+        if (type == SecondaryRays::shadow) {
+            float dir[3] = { light[0] - p[0], light[1] - p[1], light[2] - p[2] };
+            float len = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+            secondary.push_back(make_ray(p, dir, offset / len, 1.0f - offset / len));
+            continue;
+        }
+
+        // Cosine distributed direction around the normal
+        float t[3], b[3];
+        float a[3] = { std::fabs(n[0]) > 0.9f ? 0.0f : 1.0f, std::fabs(n[0]) > 0.9f ? 1.0f : 0.0f, 0.0f };
+        cross(n, a, t);
+        normalize(t);
+        cross(n, t, b);
+        float u1 = uniform(rng), u2 = uniform(rng);
+        float r = std::sqrt(u1), phi = 2.0f * pi * u2;
+        float lx = r * std::cos(phi), ly = r * std::sin(phi), lz = std::sqrt(std::max(0.0f, 1.0f - u1));
+        float dir[3];
+        for (int k = 0; k < 3; k++) dir[k] = lx * t[k] + ly * b[k] + lz * n[k];
+
+        float tmax = type == SecondaryRays::ao ? radius * diag : 1.0e+30f;
+        secondary.push_back(make_ray(p, dir, offset, tmax));
+    }
+}
+
+int pad_rays(std::vector<Ray>& rays) {
+    int count = rays.size();
+    rays.resize((count + 31) / 32 * 32, Ray{{0, 0, 0, 1}, {1, 1, 1, 0}});
+    return count;
+}
@@ -0,0 +1,41 @@
+// Ray batches passed to the traversal, and generators for the benchmarks
+#ifndef RAYS_H
+#define RAYS_H
+
+#include <vector>
+
+#include "bvh.h"
+
+// Buffers passed to traverse_accel: org.w is tmin and dir.w is tmax
+struct Ray {
+    Vec4 org;
+    Vec4 dir;
+};
+
+struct Hit {
+    int tri_id;
+    float tmax, u, v;
+};
+
+// Pinhole camera looking at the center of the scene from the front (+z) and
+// slightly above, with a 60 degree vertical field of view. Rays are in scanline
+// order.
+void generate_primary_rays(const TriMesh& mesh, int width, int height, std::vector<Ray>& rays);
+
+enum class SecondaryRays {
+    ao,         // cosine distributed, up to radius * the diagonal of the scene
+    diffuse,    // cosine distributed, unbounded
+    shadow      // towards a point light above the scene
+};
+
+// Generates one secondary ray per hit of the given rays, starting on the
+// surface that was hit. tri_ids maps hit ids to mesh triangles.
+void generate_secondary_rays(const TriMesh& mesh, const std::vector<int>& tri_ids,
+                             const std::vector<Ray>& rays, const std::vector<Hit>& hits,
+                             SecondaryRays type, float radius, unsigned seed, std::vector<Ray>& secondary);
+
+// Pads a batch with empty rays to a multiple of 32 rays, which is a multiple
+// of every packet width, and returns the number of rays before padding
+int pad_rays(std::vector<Ray>& rays);
+
+#endif // RAYS_H
@@ -0,0 +1,63 @@
+// C interface of the CPU traversal, as exported by traverse_dispatch.cpp: the
+// calls are forwarded to the widest variant of the traversal that the processor
+// supports, and accept any number of rays whatever the packet width.
+#ifndef TRAVERSE_H
+#define TRAVERSE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Closest hit of each ray: rays are 2 float4 (org, tmin, dir, tmax), hits are
+// (int tri_id, float t, float u, float v)
+void traverse_accel(const void* nodes, const void* rays, const void* tris, void* hits, int ray_count);
+
+// Cost of a ray in traverse_accel_cost: inner nodes and leaves visited, and
+// triangles tested (each triangle of a block of 4 counts, in every mapping),
+// while the ray was still active
+struct TraverseCost {
+    int nodes;
+    int leaves;
+    int tri_tests;
+};
+
+// Same as traverse_accel, and also writes the cost of each ray
+void traverse_accel_cost(const void* nodes, const void* rays, const void* tris, void* hits, struct TraverseCost* costs, int ray_count);
+
+// Any hit: the result of ray i is bit (i % 32) of occluded[i / 32], the buffer
+// must be cleared by the caller
+void traverse_occluded(const void* nodes, const void* rays, const void* tris, unsigned* occluded, int ray_count);
+
+// Number of threads used by the traversal (0 lets the runtime decide)
+void traverse_set_thread_count(int count);
+
+// Packets in which fewer rays than the threshold remain active are finished one
+// ray at a time (0 disables the switch)
+void traverse_set_single_ray_threshold(int threshold);
+
+// Counters of traverse_accel and traverse_occluded, summed over all the calls
+// since the last reset. They are only collected when the traversal is compiled
+// with collect_stats set to true in common.impala. Rays that a packet finishes
+// one at a time (see traverse_set_single_ray_threshold) are not counted after
+// the switch.
+struct TraverseStats {
+    unsigned long long nodes;               // inner nodes visited by at least one ray
+    unsigned long long leaves;              // leaves visited by at least one ray
+    unsigned long long tri_tests;           // triangle tests (one per packet and triangle, or per ray and triangle)
+    unsigned long long max_depth;           // high-water mark of the traversal stack
+    unsigned long long active_lanes[17];    // node visits with 0 to 16 active rays
+};
+
+// Returns 0 when the statistics are not compiled in (the counters are then 0)
+int traverse_read_stats(struct TraverseStats* stats);
+void traverse_reset_stats();
+
+// Name of the selected variant ("sse42", "avx", "avx2" or "avx512") and its packet width
+const char* traverse_isa();
+int traverse_packet_size();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRAVERSE_H
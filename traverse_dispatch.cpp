@@ -0,0 +1,189 @@
+// Runtime selection of the CPU traversal. The traversal is compiled once per
+// instruction set (isa_*.impala), and the exported symbols of each object are
+// suffixed with the name of its instruction set, e.g. traverse_accel_avx2. The
+// widest variant supported by the processor is selected on the first call, and
+// can be lowered with the TRAVERSE_ISA environment variable.
+#include <cpuid.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "traverse.h"
+
+#define DECLARE_VARIANT(isa) \
+    extern "C" { \
+        void traverse_accel_##isa(const void*, const void*, const void*, void*, int); \
+        void traverse_accel_cost_##isa(const void*, const void*, const void*, void*, TraverseCost*, int); \
+        void traverse_occluded_##isa(const void*, const void*, const void*, unsigned*, int); \
+        void traverse_set_thread_count_##isa(int); \
+        void traverse_set_single_ray_threshold_##isa(int); \
+        int traverse_read_stats_##isa(TraverseStats*); \
+        void traverse_reset_stats_##isa(); \
+    }
+
+DECLARE_VARIANT(sse42)
+DECLARE_VARIANT(avx)
+DECLARE_VARIANT(avx2)
+DECLARE_VARIANT(avx512)
+
+namespace {
+
+struct Variant {
+    const char* name;
+    int packet_size;
+    bool (*supported)();
+    void (*accel)(const void*, const void*, const void*, void*, int);
+    void (*accel_cost)(const void*, const void*, const void*, void*, TraverseCost*, int);
+    void (*occluded)(const void*, const void*, const void*, unsigned*, int);
+    void (*set_thread_count)(int);
+    void (*set_single_ray_threshold)(int);
+    int (*read_stats)(TraverseStats*);
+    void (*reset_stats)();
+};
+
+struct Ray { float org[4]; float dir[4]; };
+struct Hit { int tri_id; float tmax, u, v; };
+
+// A chunk of the traversal covers a multiple of 32 rays, which is a multiple of
+// every packet width: the rays after the last multiple of 32 are traced from a
+// padded copy
+const int tail_size = 32;
+
+bool has_cpuid(unsigned leaf, unsigned sub, unsigned& ebx, unsigned& ecx) {
+    unsigned eax, edx;
+    return __get_cpuid_count(leaf, sub, &eax, &ebx, &ecx, &edx) != 0;
+}
+
+// The registers must also be saved by the operating system (XCR0)
+bool os_saves(unsigned mask) {
+    unsigned ebx, ecx;
+    if (!has_cpuid(1, 0, ebx, ecx) || !(ecx & bit_OSXSAVE)) return false;
+    unsigned lo, hi;
+    __asm__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (lo & mask) == mask;
+}
+
+bool has_sse42() {
+    unsigned ebx, ecx;
+    return has_cpuid(1, 0, ebx, ecx) && (ecx & bit_SSE4_2);
+}
+
+bool has_avx() {
+    unsigned ebx, ecx;
+    return has_cpuid(1, 0, ebx, ecx) && (ecx & bit_AVX) && os_saves(0x6);
+}
+
+bool has_avx2() {
+    unsigned ebx1, ecx1, ebx7, ecx7;
+    return has_avx() &&
+           has_cpuid(1, 0, ebx1, ecx1) && (ecx1 & bit_FMA) &&
+           has_cpuid(7, 0, ebx7, ecx7) && (ebx7 & bit_AVX2);
+}
+
+bool has_avx512() {
+    unsigned ebx, ecx;
+    return has_avx2() && has_cpuid(7, 0, ebx, ecx) && (ebx & bit_AVX512F) && os_saves(0xE6);
+}
+
+// From the widest to the narrowest
+const Variant variants[] = {
+    { "avx512", 16, has_avx512, traverse_accel_avx512, traverse_accel_cost_avx512, traverse_occluded_avx512, traverse_set_thread_count_avx512, traverse_set_single_ray_threshold_avx512, traverse_read_stats_avx512, traverse_reset_stats_avx512 },
+    { "avx2",    8, has_avx2,   traverse_accel_avx2,   traverse_accel_cost_avx2,   traverse_occluded_avx2,   traverse_set_thread_count_avx2,   traverse_set_single_ray_threshold_avx2,   traverse_read_stats_avx2,   traverse_reset_stats_avx2 },
+    { "avx",     8, has_avx,    traverse_accel_avx,    traverse_accel_cost_avx,    traverse_occluded_avx,    traverse_set_thread_count_avx,    traverse_set_single_ray_threshold_avx,    traverse_read_stats_avx,    traverse_reset_stats_avx },
+    { "sse42",   4, has_sse42,  traverse_accel_sse42,  traverse_accel_cost_sse42,  traverse_occluded_sse42,  traverse_set_thread_count_sse42,  traverse_set_single_ray_threshold_sse42,  traverse_read_stats_sse42,  traverse_reset_stats_sse42 },
+};
+
+const Variant& select_variant() {
+    const char* forced = std::getenv("TRAVERSE_ISA");
+    bool skip = forced != nullptr;
+    for (const Variant& variant : variants) {
+        if (skip && !std::strcmp(variant.name, forced)) skip = false;
+        if (!skip && variant.supported()) return variant;
+    }
+    if (skip) {
+        std::fprintf(stderr, "unknown TRAVERSE_ISA '%s', using the default\n", forced);
+        for (const Variant& variant : variants) {
+            if (variant.supported()) return variant;
+        }
+    }
+    std::fprintf(stderr, "the traversal requires at least SSE4.2\n");
+    std::abort();
+}
+
+const Variant& variant() {
+    static const Variant& selected = select_variant();
+    return selected;
+}
+
+// Copies the last rays to a buffer padded with empty rays
+std::vector<Ray> pad_tail(const void* rays, int first, int count) {
+    std::vector<Ray> tail(tail_size, Ray{{0, 0, 0, 1}, {1, 1, 1, 0}});
+    std::memcpy(tail.data(), static_cast<const Ray*>(rays) + first, count * sizeof(Ray));
+    return tail;
+}
+
+} // namespace
+
+extern "C" {
+
+void traverse_accel(const void* nodes, const void* rays, const void* tris, void* hits, int ray_count) {
+    int body = ray_count / tail_size * tail_size;
+    if (body > 0) variant().accel(nodes, rays, tris, hits, body);
+    if (body == ray_count) return;
+
+    std::vector<Ray> tail = pad_tail(rays, body, ray_count - body);
+    std::vector<Hit> tail_hits(tail_size);
+    variant().accel(nodes, tail.data(), tris, tail_hits.data(), tail_size);
+    std::memcpy(static_cast<Hit*>(hits) + body, tail_hits.data(), (ray_count - body) * sizeof(Hit));
+}
+
+void traverse_accel_cost(const void* nodes, const void* rays, const void* tris, void* hits, TraverseCost* costs, int ray_count) {
+    int body = ray_count / tail_size * tail_size;
+    if (body > 0) variant().accel_cost(nodes, rays, tris, hits, costs, body);
+    if (body == ray_count) return;
+
+    std::vector<Ray> tail = pad_tail(rays, body, ray_count - body);
+    std::vector<Hit> tail_hits(tail_size);
+    std::vector<TraverseCost> tail_costs(tail_size);
+    variant().accel_cost(nodes, tail.data(), tris, tail_hits.data(), tail_costs.data(), tail_size);
+    std::memcpy(static_cast<Hit*>(hits) + body, tail_hits.data(), (ray_count - body) * sizeof(Hit));
+    std::memcpy(costs + body, tail_costs.data(), (ray_count - body) * sizeof(TraverseCost));
+}
+
+void traverse_occluded(const void* nodes, const void* rays, const void* tris, unsigned* occluded, int ray_count) {
+    int body = ray_count / tail_size * tail_size;
+    if (body > 0) variant().occluded(nodes, rays, tris, occluded, body);
+    if (body == ray_count) return;
+
+    std::vector<Ray> tail = pad_tail(rays, body, ray_count - body);
+    unsigned tail_bits = 0;
+    variant().occluded(nodes, tail.data(), tris, &tail_bits, tail_size);
+    occluded[body / 32] |= tail_bits & ((1u << (ray_count - body)) - 1);
+}
+
+void traverse_set_thread_count(int count) {
+    variant().set_thread_count(count);
+}
+
+void traverse_set_single_ray_threshold(int threshold) {
+    variant().set_single_ray_threshold(threshold);
+}
+
+int traverse_read_stats(TraverseStats* stats) {
+    return variant().read_stats(stats);
+}
+
+void traverse_reset_stats() {
+    variant().reset_stats();
+}
+
+const char* traverse_isa() {
+    return variant().name;
+}
+
+int traverse_packet_size() {
+    return variant().packet_size;
+}
+
+}